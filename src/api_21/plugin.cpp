@@ -12,6 +12,7 @@
 #endif
 
 #include <freq_cutoff.h>
+#include <freq_cutoff_dialog.h>
 #include <freq_cutoff_plugin.h>
 #include <plugin.h>
 
@@ -93,6 +94,8 @@ int ts3plugin_init() {
 
 /* Custom code called right before the plugin is unloaded */
 void ts3plugin_shutdown() {
+    freq_cutoff_shutdown(ts3Functions);
+
     /*
      * Note:
      * If your plugin implements a settings dialog, it must be closed and
@@ -308,8 +311,8 @@ void ts3plugin_initMenus(struct PluginMenuItem*** menuItems, char** menuIcon) {
 void ts3plugin_onConnectStatusChangeEvent(uint64 serverConnectionHandlerID,
                                           int newStatus,
                                           unsigned int errorNumber) {
-    /* Some example code following to show how to use the information query
-     * functions. */
+    freq_cutoff_onConnectStatusChangeEvent(
+        ts3Functions, serverConnectionHandlerID, newStatus);
 }
 
 void ts3plugin_onNewChannelEvent(uint64 serverConnectionHandlerID,
@@ -343,40 +346,61 @@ void ts3plugin_onUpdateChannelEditedEvent(uint64 serverConnectionHandlerID,
 void ts3plugin_onUpdateClientEvent(uint64 serverConnectionHandlerID,
                                    anyID clientID, anyID invokerID,
                                    const char* invokerName,
-                                   const char* invokerUniqueIdentifier) {}
+                                   const char* invokerUniqueIdentifier) {
+    freq_cutoff_onUpdateClientEvent(ts3Functions, serverConnectionHandlerID,
+                                    clientID);
+}
 
 void ts3plugin_onClientMoveEvent(uint64 serverConnectionHandlerID,
                                  anyID clientID, uint64 oldChannelID,
                                  uint64 newChannelID, int visibility,
-                                 const char* moveMessage) {}
+                                 const char* moveMessage) {
+    freq_cutoff_onClientMoveEvent(ts3Functions, serverConnectionHandlerID,
+                                  clientID, visibility);
+}
 
 void ts3plugin_onClientMoveSubscriptionEvent(uint64 serverConnectionHandlerID,
                                              anyID clientID,
                                              uint64 oldChannelID,
                                              uint64 newChannelID,
-                                             int visibility) {}
+                                             int visibility) {
+    freq_cutoff_onClientMoveEvent(ts3Functions, serverConnectionHandlerID,
+                                  clientID, visibility);
+}
 
 void ts3plugin_onClientMoveTimeoutEvent(uint64 serverConnectionHandlerID,
                                         anyID clientID, uint64 oldChannelID,
                                         uint64 newChannelID, int visibility,
-                                        const char* timeoutMessage) {}
+                                        const char* timeoutMessage) {
+    freq_cutoff_onClientMoveEvent(ts3Functions, serverConnectionHandlerID,
+                                  clientID, visibility);
+}
 
 void ts3plugin_onClientMoveMovedEvent(uint64 serverConnectionHandlerID,
                                       anyID clientID, uint64 oldChannelID,
                                       uint64 newChannelID, int visibility,
                                       anyID moverID, const char* moverName,
                                       const char* moverUniqueIdentifier,
-                                      const char* moveMessage) {}
+                                      const char* moveMessage) {
+    freq_cutoff_onClientMoveEvent(ts3Functions, serverConnectionHandlerID,
+                                  clientID, visibility);
+}
 
 void ts3plugin_onClientKickFromChannelEvent(
     uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID,
     uint64 newChannelID, int visibility, anyID kickerID, const char* kickerName,
-    const char* kickerUniqueIdentifier, const char* kickMessage) {}
+    const char* kickerUniqueIdentifier, const char* kickMessage) {
+    freq_cutoff_onClientMoveEvent(ts3Functions, serverConnectionHandlerID,
+                                  clientID, visibility);
+}
 
 void ts3plugin_onClientKickFromServerEvent(
     uint64 serverConnectionHandlerID, anyID clientID, uint64 oldChannelID,
     uint64 newChannelID, int visibility, anyID kickerID, const char* kickerName,
-    const char* kickerUniqueIdentifier, const char* kickMessage) {}
+    const char* kickerUniqueIdentifier, const char* kickMessage) {
+    freq_cutoff_onClientMoveEvent(ts3Functions, serverConnectionHandlerID,
+                                  clientID, visibility);
+}
 
 void ts3plugin_onClientIDsEvent(uint64 serverConnectionHandlerID,
                                 const char* uniqueClientIdentifier,
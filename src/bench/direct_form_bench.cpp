@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Compares the direct form kernel with the ring indexing it replaced, which
+// found the history with (index - i + buffer_size) % buffer_size: checks that
+// both give the same output sample for sample, then times them on the frame
+// sizes the playback callback delivers. Built with FREQ_CUTOFF_DIRECT_FORM
+// whatever the rest of the build uses, and exits with 1 on any difference.
+//
+//   frequency_cutoff_direct_form_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <filter_kernels.h>
+
+constexpr int buffer_size = 8;
+
+// the state of one channel as it was kept before
+class ModuloChannelFilter {
+   public:
+    double x[buffer_size] = {0};
+    double y[buffer_size] = {0};
+    int index = 0;
+};
+
+class ModuloFilter {
+   public:
+    ModuloChannelFilter channel_filters[max_channels];
+};
+
+// The previous kernel, summing in the same order. (It also wrote each output
+// to every channel of the frame, which later channels then read back as
+// input -- that bug is not kept, so stereo can be compared too.)
+void filter_modulo(const ButterworthCoefficients& coefficients,
+                   ModuloFilter& filter, short* samples, int sample_count,
+                   int channels) {
+    for (int c = 0; c < channels; c++) {
+        ModuloChannelFilter& channel_filter = filter.channel_filters[c];
+        for (int s = 0; s < sample_count; s++) {
+            double new_x = (double)samples[s * channels + c];
+            double new_y = (coefficients.b[0]) * new_x;
+            for (int i = 1; i <= buffer_size; i++) {
+                new_y += (coefficients.b[i] *
+                          channel_filter.x[(channel_filter.index - i +
+                                            buffer_size) %
+                                           buffer_size]);
+                new_y -= (coefficients.a[i] *
+                          channel_filter.y[(channel_filter.index - i +
+                                            buffer_size) %
+                                           buffer_size]);
+            }
+            channel_filter.x[channel_filter.index % buffer_size] = new_x;
+            channel_filter.y[channel_filter.index % buffer_size] = new_y;
+            samples[s * channels + c] = (short)new_y;
+            channel_filter.index = (channel_filter.index + 1) % buffer_size;
+        }
+    }
+}
+
+std::vector<short> noise(size_t size, unsigned int seed) {
+    std::vector<short> samples(size);
+    for (short& sample : samples) {
+        seed = seed * 1103515245 + 12345;
+        sample = (short)((seed >> 16) % 8000);
+    }
+    return samples;
+}
+
+// true if both kernels give the same output over a run of frames
+bool same_output(int cutoff_freq, int channels, int sample_count) {
+    auto coefficients =
+        std::make_shared<const ButterworthCoefficients>(cutoff_freq, 8);
+    ButterworthFilter filter(coefficients);
+    ModuloFilter reference;
+    for (int frame = 0; frame < 200; frame++) {
+        std::vector<short> samples =
+            noise(sample_count * channels, frame + 1);
+        std::vector<short> expected = samples;
+        filter_direct_form<8>(*coefficients, filter, samples.data(),
+                              sample_count, channels);
+        filter_modulo(*coefficients, reference, expected.data(),
+                      sample_count, channels);
+        if (samples != expected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// microseconds per frame
+template <typename Filter, typename F>
+double time_kernel(F kernel, Filter& filter,
+                   const ButterworthCoefficients& coefficients, int channels,
+                   int sample_count, int iterations) {
+    std::vector<short> input = noise(sample_count * channels, 1);
+    std::vector<short> samples(input.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        std::copy(input.begin(), input.end(), samples.begin());
+        kernel(coefficients, filter, samples.data(), sample_count, channels);
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    int failures = 0;
+    for (int cutoff_freq : {1000, 4000, 9000}) {
+        for (int channels = 1; channels <= max_channels; channels++) {
+            for (int sample_count : {480, 960}) {
+                if (!same_output(cutoff_freq, channels, sample_count)) {
+                    printf("cutoff %i Hz, %i channel(s), %i samples: output "
+                           "differs from the modulo kernel\n",
+                           cutoff_freq, channels, sample_count);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    printf("order 8, %i iterations\n", iterations);
+    auto coefficients =
+        std::make_shared<const ButterworthCoefficients>(4000, 8);
+    for (int channels = 1; channels <= max_channels; channels++) {
+        for (int sample_count : {480, 960}) {
+            ModuloFilter reference;
+            double modulo_us =
+                time_kernel(filter_modulo, reference, *coefficients, channels,
+                            sample_count, iterations);
+            ButterworthFilter filter(coefficients);
+            double us = time_kernel(filter_direct_form<8>, filter,
+                                    *coefficients, channels, sample_count,
+                                    iterations);
+            printf("%i channel(s), %i samples: %.2f us (modulo %.2f us)\n",
+                   channels, sample_count, us, modulo_us);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Times the filter kernels the build selects (see select_kernels) on the frame
+// sizes the playback callback delivers: 480 and 960 samples, mono and stereo,
+// at every order.
+//
+//   frequency_cutoff_kernel_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <filter_kernels.h>
+
+// microseconds per frame
+double time_kernel(KernelFunction kernel, int order, int channels,
+                   int sample_count, int iterations) {
+    ButterworthCoefficients coefficients(4000, order);
+    ButterworthFilter filter(
+        std::make_shared<const ButterworthCoefficients>(coefficients));
+    std::vector<short> input(sample_count * channels);
+    unsigned int seed = 1;
+    for (short& sample : input) {
+        seed = seed * 1103515245 + 12345;
+        sample = (short)((seed >> 16) % 8000);
+    }
+    std::vector<short> samples(input.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        std::copy(input.begin(), input.end(), samples.begin());
+        kernel(coefficients, filter, samples.data(), sample_count, channels);
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    KernelTable kernels = select_kernels();
+    printf("%s kernels, %i iterations\n", kernels.name, iterations);
+    for (int order = 2; order <= max_order; order += 2) {
+        for (int channels = 1; channels <= max_channels; channels++) {
+            for (int sample_count : {480, 960}) {
+                double us = time_kernel(kernels.get(order, channels), order,
+                                        channels, sample_count, iterations);
+                printf("order %i, %i channel(s), %i samples: %.2f us\n", order,
+                       channels, sample_count, us);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Times loading a large text config, as the plugin does at startup: entries
+// with uids shaped like the client's (28 characters of base64) and a quarter
+// of them without an order, like files written before it was added. The
+// config is written to the given directory and removed afterwards.
+//
+//   frequency_cutoff_startup_bench [entries] [directory]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <freq_cutoff.h>
+
+#include <teamspeak/public_errors.h>
+
+constexpr int runs = 5;
+
+unsigned int log_message(const char*, LogLevel, const char*, uint64) {
+    return ERROR_ok;
+}
+
+// a distinct, made up uid for every index
+std::string bench_uid(int index) {
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string uid(28, '=');
+    unsigned int hash = (unsigned int)index * 2654435761u;
+    for (int i = 0; i < 27; i++) {
+        uid[i] = digits[((hash >> (i % 26)) ^ (i * 7 + index)) & 63];
+    }
+    return uid;
+}
+
+int main(int argc, char** argv) {
+    int entries = argc > 1 ? atoi(argv[1]) : 100000;
+    std::string filename = std::string(argc > 2 ? argv[2] : ".") +
+                           "/frequency_cutoff_startup_bench.conf";
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+        printf("Could not write %s\n", filename.c_str());
+        return 1;
+    }
+    for (int i = 0; i < entries; i++) {
+        std::string uid = bench_uid(i);
+        int cutoff_freq = 100 * (1 + i % 200);
+        int enabled = i % 3 != 0;
+        if (i % 4 == 0) {
+            fprintf(file, "%s %i %i\n", uid.c_str(), cutoff_freq, enabled);
+        } else {
+            fprintf(file, "%s %i %i %i\n", uid.c_str(), cutoff_freq, enabled,
+                    2 + 2 * (i % 4));
+        }
+    }
+    fclose(file);
+    // the plugin prefers a binary config next to the text one
+    remove(binary_config_name(filename).c_str());
+
+    static TS3Functions ts3_functions;
+    ts3_functions.logMessage = log_message;
+    double best = 0;
+    size_t loaded = 0;
+    for (int run = 0; run < runs; run++) {
+        auto start = std::chrono::steady_clock::now();
+        ApplicationFilterGroup filter_group(ts3_functions, filename);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+        loaded = 0;
+        filter_group.load_confs().for_each(
+            [&](const string&, const FilterConf&) { loaded++; });
+    }
+    remove(filename.c_str());
+    printf("%i entries: %.1f ms to load (best of %i), %zu filter confs\n",
+           entries, best, runs, loaded);
+    return 0;
+}
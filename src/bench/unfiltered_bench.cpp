@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Times the playback callback for 100 speakers on one server, none of whom
+// has a filter (the common case), while a few other users do. Those speakers
+// should cost one load and one compare per frame.
+//
+//   frequency_cutoff_unfiltered_bench [frames]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <freq_cutoff_plugin.h>
+
+constexpr int speaker_count = 100;
+constexpr uint64 bench_server = 1;
+
+unsigned int server_list(uint64** result) {
+    uint64* servers = (uint64*)malloc(2 * sizeof(uint64));
+    servers[0] = bench_server;
+    servers[1] = 0;
+    *result = servers;
+    return ERROR_ok;
+}
+
+unsigned int client_list(uint64, anyID** result) {
+    anyID* clients = (anyID*)malloc((speaker_count + 1) * sizeof(anyID));
+    for (int i = 0; i < speaker_count; i++) {
+        clients[i] = (anyID)(i + 1);
+    }
+    clients[speaker_count] = 0;
+    *result = clients;
+    return ERROR_ok;
+}
+
+unsigned int client_uid(uint64, anyID client_id, size_t, char** result) {
+    std::string uid = "speaker" + std::to_string(client_id);
+    *result = strdup(uid.c_str());
+    return ERROR_ok;
+}
+
+unsigned int log_message(const char*, LogLevel, const char*, uint64) {
+    return ERROR_ok;
+}
+
+unsigned int free_memory(void* pointer) {
+    free(pointer);
+    return ERROR_ok;
+}
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 10000;
+    static TS3Functions ts3_functions;
+    ts3_functions.getServerConnectionHandlerList = server_list;
+    ts3_functions.getClientList = client_list;
+    ts3_functions.getClientVariableAsString = client_uid;
+    ts3_functions.logMessage = log_message;
+    ts3_functions.freeMemory = free_memory;
+    // no config file is read from a directory that does not exist
+    if (freq_cutoff_init("frequency_cutoff_bench_missing", ts3_functions) !=
+        0) {
+        return 1;
+    }
+    for (int i = 0; i < 20; i++) {
+        FilterConf conf(true, 1000 + 100 * i);
+        filter_group->update_conf("listener" + std::to_string(i), &conf);
+    }
+
+    static short samples[960 * 2];
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        for (anyID client_id = 1; client_id <= speaker_count; client_id++) {
+            freq_cutoff_onEditPlaybackVoiceDataEvent(
+                ts3_functions, bench_server, client_id, samples, 960, 2);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("%i unfiltered speakers: %.1f ns per callback\n", speaker_count,
+           elapsed.count() / ((double)frames * speaker_count));
+
+    freq_cutoff_shutdown(ts3_functions);
+    return 0;
+}
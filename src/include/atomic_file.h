@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+// windows.h must not define min and max over std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Writing a file so that a crash (of the client or the machine) at any point
+// leaves either its old or its new contents, never a truncated mix: the
+// contents go to a temporary file next to it, are flushed to the disk, and
+// only then renamed over the original. The two steps are separate for
+// callers that need to do something just before the rename.
+
+// the temporary file write_file_synced / replace_file use for a file
+std::string temporary_file_name(const std::string& filename) {
+    return filename + ".tmp";
+}
+
+// Writes the contents to the file's temporary file and flushes them to the
+// disk. Throws a runtime_error (after removing it) if that fails.
+#ifdef _WIN32
+void write_file_synced(const std::string& filename,
+                       const std::string& contents) {
+    std::string temporary = temporary_file_name(filename);
+    HANDLE file = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not create " + temporary);
+    }
+    DWORD written = 0;
+    bool ok = WriteFile(file, contents.data(), (DWORD)contents.size(),
+                        &written, NULL) &&
+              written == contents.size() && FlushFileBuffers(file);
+    CloseHandle(file);
+    if (!ok) {
+        DeleteFileA(temporary.c_str());
+        throw std::runtime_error("Could not write " + temporary);
+    }
+}
+
+// Renames the file's temporary file over it. Throws a runtime_error (after
+// removing the temporary file) if that fails.
+void replace_file(const std::string& filename) {
+    std::string temporary = temporary_file_name(filename);
+    if (!MoveFileExA(temporary.c_str(), filename.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        DeleteFileA(temporary.c_str());
+        throw std::runtime_error("Could not replace " + filename);
+    }
+}
+#else
+void write_file_synced(const std::string& filename,
+                       const std::string& contents) {
+    std::string temporary = temporary_file_name(filename);
+    int file = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        throw std::runtime_error("Could not create " + temporary + ": " +
+                                 std::strerror(errno));
+    }
+    const char* data = contents.data();
+    size_t remaining = contents.size();
+    bool ok = true;
+    while (ok && remaining > 0) {
+        ssize_t written = write(file, data, remaining);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = written > 0;
+        if (ok) {
+            data += written;
+            remaining -= written;
+        }
+    }
+    int error = 0;
+    if (!ok) {
+        error = errno != 0 ? errno : EIO;
+    } else if (fsync(file) != 0) {
+        error = errno;
+    }
+    if (close(file) != 0 && error == 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not write " + temporary + ": " +
+                                 std::strerror(error));
+    }
+}
+
+void replace_file(const std::string& filename) {
+    std::string temporary = temporary_file_name(filename);
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        int error = errno;
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not replace " + filename + ": " +
+                                 std::strerror(error));
+    }
+    // the rename itself is only durable once the directory is synced (best
+    // effort -- the contents are already safe either way)
+    size_t separator = filename.find_last_of('/');
+    std::string directory =
+        separator == std::string::npos ? "." : filename.substr(0, separator);
+    int directory_file = open(directory.c_str(), O_RDONLY);
+    if (directory_file >= 0) {
+        fsync(directory_file);
+        close(directory_file);
+    }
+}
+#endif
+
+// Replaces a file's contents in both steps.
+void write_file_atomic(const std::string& filename,
+                       const std::string& contents) {
+    write_file_synced(filename, contents);
+    replace_file(filename);
+}
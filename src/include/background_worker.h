@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <ts3_log.h>
+
+// The plugin's own thread, for work that has no place on the audio thread (or
+// the client's event and GUI threads): formatting and passing on log
+// messages, writing the config and the like. Work is posted as small tasks
+// into a bounded lock free queue, which any thread (including the audio
+// callback) can do without locking, allocating or blocking. The worker runs
+// the tasks in the order they were posted, except for delayed ones (see
+// post_after), which wait on the worker's side until they are due.
+//
+// A task is any trivially copyable callable of up to task_size bytes (e.g. a
+// lambda capturing a few pointers and numbers by value). It is copied into
+// the queue as is, so whatever it points to must outlive the worker's next
+// drain.
+class BackgroundWorker {
+   public:
+    // tasks that can wait for the worker before further ones are refused
+    static constexpr size_t capacity = 256;
+    static constexpr size_t task_size = 40;
+    // how often the worker drains the queue (the producers never wake it, as
+    // that could block them)
+    static constexpr std::chrono::milliseconds drain_interval{50};
+
+   private:
+    static_assert((capacity & (capacity - 1)) == 0,
+                  "the queue capacity must be a power of two");
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    // one cache line per cell, together with the sequence
+    class Task {
+       public:
+        void (*run)(const Task& task);
+        // the default (the clock's epoch) is always due
+        TimePoint due;
+        alignas(8) unsigned char storage[task_size];
+    };
+
+    // A bounded multi producer, single consumer ring (after Vyukov). Each
+    // cell's sequence tells whose turn it is: equal to a producer's position
+    // when the cell is free for it, one past it once the task is written.
+    class alignas(64) Cell {
+       public:
+        std::atomic<size_t> sequence;
+        Task task;
+    };
+
+    const TS3Functions& ts3_functions;
+    Cell cells[capacity];
+    alignas(64) std::atomic<size_t> enqueue_position{0};
+    alignas(64) size_t dequeue_position = 0;
+
+    // delayed tasks that are not due yet -- only touched by the worker
+    std::vector<Task> waiting;
+
+    std::mutex stop_lock;
+    std::condition_variable stop_signal;
+    bool stopping = false;
+    std::thread worker;
+
+    bool pop(Task& task) {
+        Cell& cell = cells[dequeue_position & (capacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) !=
+            dequeue_position + 1) {
+            return false;
+        }
+        task = cell.task;
+        cell.sequence.store(dequeue_position + capacity,
+                            std::memory_order_release);
+        dequeue_position++;
+        return true;
+    }
+
+    void execute(const Task& task) {
+        try {
+            task.run(task);
+        } catch (const std::exception& e) {
+            log_error(ts3_functions, "A background task failed: %s",
+                      e.what());
+        } catch (...) {
+            log_error(ts3_functions, "A background task failed");
+        }
+    }
+
+    // runs what is due, or everything (when stopping)
+    void drain(bool all) {
+        TimePoint now = std::chrono::steady_clock::now();
+        Task task;
+        while (pop(task)) {
+            if (!all && task.due > now) {
+                waiting.push_back(task);
+            } else {
+                execute(task);
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < waiting.size(); i++) {
+            if (!all && waiting[i].due > now) {
+                waiting[kept++] = waiting[i];
+            } else {
+                execute(waiting[i]);
+            }
+        }
+        waiting.resize(kept);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(stop_lock);
+        while (!stopping) {
+            stop_signal.wait_for(lock, drain_interval);
+            lock.unlock();
+            drain(false);
+            lock.lock();
+        }
+        // the stop may have come before the first wait, or during a drain
+        lock.unlock();
+        drain(true);
+    }
+
+    template <typename F>
+    bool post_due(TimePoint due, const F& function) {
+        static_assert(std::is_trivially_copyable<F>::value,
+                      "background tasks are copied as bytes");
+        static_assert(sizeof(F) <= task_size, "background task too large");
+        static_assert(alignof(F) <= 8,
+                      "background task alignment not supported");
+
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[position & (capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                // the worker has not caught up with this cell yet
+                return false;
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->task.storage) F(function);
+        cell->task.run = [](const Task& task) {
+            (*reinterpret_cast<const F*>(task.storage))();
+        };
+        cell->task.due = due;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+   public:
+    BackgroundWorker(const TS3Functions& ts3_functions)
+        : ts3_functions(ts3_functions) {
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        waiting.reserve(capacity);
+        worker = std::thread(&BackgroundWorker::run, this);
+    }
+
+    BackgroundWorker(const BackgroundWorker&) = delete;
+    BackgroundWorker& operator=(const BackgroundWorker&) = delete;
+
+    // runs what is left (if stop has not) before returning
+    ~BackgroundWorker() { stop(); }
+
+    // Stops the worker once it has run what was posted, delayed tasks
+    // included (without waiting for them to be due). Always waits for the
+    // thread to finish, however long a task in progress takes: the tasks
+    // (and the thread itself) run code that may be unloaded after this.
+    void stop() {
+        if (!worker.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(stop_lock);
+            stopping = true;
+        }
+        stop_signal.notify_one();
+        worker.join();
+    }
+
+    // Queues a task without locking, allocating or blocking. Returns false
+    // (and drops the task) when the queue is full.
+    template <typename F>
+    bool post(const F& function) {
+        return post_due(TimePoint(), function);
+    }
+
+    // Like post, but the task is only run once the delay has passed (give or
+    // take the drain interval), or when the worker is stopped.
+    template <typename F>
+    bool post_after(std::chrono::milliseconds delay, const F& function) {
+        return post_due(std::chrono::steady_clock::now() + delay, function);
+    }
+};
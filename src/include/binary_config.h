@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+// keeps the min and max macros out of std::max and numeric_limits<>::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <config_parser.h>
+
+// A whole file mapped read only into memory. Its pages are only read in (and
+// only take up memory) as they are touched. Throws a runtime_error if the
+// file cannot be mapped.
+class MappedFile {
+   private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE mapping = NULL;
+#endif
+
+   public:
+    MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        HANDLE file =
+            CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) ||
+            size.QuadPart == 0) {
+            if (file != INVALID_HANDLE_VALUE) {
+                CloseHandle(file);
+            }
+            throw std::runtime_error("Could not open " + filename);
+        }
+        length = (size_t)size.QuadPart;
+        // the mapping keeps the file open
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (mapping != NULL) {
+            bytes = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (bytes == nullptr) {
+            if (mapping != NULL) {
+                CloseHandle(mapping);
+            }
+            throw std::runtime_error("Could not map " + filename);
+        }
+#else
+        int file = open(filename.c_str(), O_RDONLY);
+        struct stat status;
+        if (file < 0 || fstat(file, &status) != 0 || status.st_size == 0) {
+            if (file >= 0) {
+                close(file);
+            }
+            throw std::runtime_error("Could not open " + filename);
+        }
+        length = (size_t)status.st_size;
+        // the mapping stays valid after the descriptor is closed
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+        close(file);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("Could not map " + filename);
+        }
+        bytes = (const char*)mapped;
+        // the lookups jump around the file, so reading ahead would only
+        // bring in pages nobody asked for
+        madvise(mapped, length, MADV_RANDOM);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+        CloseHandle(mapping);
+#else
+        munmap((void*)bytes, length);
+#endif
+    }
+
+    const char* data() const { return bytes; }
+
+    size_t size() const { return length; }
+};
+
+// The binary config format, for rule sets too large to parse at every start.
+// All numbers are little endian:
+//
+//   header: "FCUT", u32 version, u32 key width, u32 entry count
+//   entry:  uid (zero padded to the key width), i32 cutoff, u8 enabled,
+//           u8 order (0 if none), u16 reserved
+//
+// The entries are sorted by uid (as bytes) without duplicates, so a uid is
+// found by a binary search over the mapped file, and the key width (a
+// multiple of 8) keeps every entry 8 byte aligned. Entries carry the same
+// fields as a text config line, and the order is checked by the reader just
+// the same.
+class BinaryConfig {
+   public:
+    static constexpr char magic[4] = {'F', 'C', 'U', 'T'};
+    static constexpr uint32_t version = 1;
+    static constexpr size_t header_size = 16;
+    // entry size besides the key
+    static constexpr size_t value_size = 8;
+
+   private:
+    MappedFile file;
+    size_t key_width;
+    size_t count;
+    size_t entry_size;
+    const char* entries;
+
+    static uint32_t read_u32(const char* bytes) {
+        const unsigned char* b = (const unsigned char*)bytes;
+        return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    }
+
+    std::string_view key(size_t index) const {
+        const char* start = entries + index * entry_size;
+        return std::string_view(start, strnlen(start, key_width));
+    }
+
+   public:
+    // Maps the file and checks its header -- the entries are only read as
+    // they are looked up. Throws a runtime_error if the file is not a valid
+    // binary config.
+    BinaryConfig(const std::string& filename) : file(filename) {
+        const char* data = file.data();
+        if (file.size() < header_size ||
+            std::memcmp(data, magic, sizeof(magic)) != 0 ||
+            read_u32(data + 4) != version) {
+            throw std::runtime_error(filename + " is not a binary config");
+        }
+        key_width = read_u32(data + 8);
+        count = read_u32(data + 12);
+        entry_size = key_width + value_size;
+        entries = data + header_size;
+        if (key_width == 0 || key_width % 8 != 0 ||
+            (file.size() - header_size) / entry_size != count ||
+            (file.size() - header_size) % entry_size != 0) {
+            throw std::runtime_error(filename + " is truncated or corrupt");
+        }
+    }
+
+    size_t size() const { return count; }
+
+    // the entry at an index, in uid order (the name points into the file)
+    ConfigLine entry(size_t index) const {
+        const char* value = entries + index * entry_size + key_width;
+        ConfigLine line;
+        line.name = key(index);
+        line.cutoff_freq = (int32_t)read_u32(value);
+        line.enabled = value[4] != 0;
+        line.order = (unsigned char)value[5];
+        return line;
+    }
+
+    // binary search for a uid, touching O(log n) pages
+    bool find(std::string_view uid, ConfigLine& found) const {
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            int compared = key(middle).compare(uid);
+            if (compared == 0) {
+                found = entry(middle);
+                return true;
+            }
+            if (compared < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return false;
+    }
+};
+
+// Encodes config entries in the binary format. They have to be sorted by
+// name without duplicates (as a ConfMap iterates, or a text config after
+// load_config_lines).
+std::string encode_binary_config(const std::vector<ConfigLine>& lines) {
+    size_t longest = 0;
+    for (const ConfigLine& line : lines) {
+        longest = std::max(longest, line.name.size());
+    }
+    size_t key_width = std::max<size_t>(8, (longest + 7) / 8 * 8);
+    size_t entry_size = key_width + BinaryConfig::value_size;
+
+    std::string encoded(
+        BinaryConfig::header_size + lines.size() * entry_size, '\0');
+    auto write_u32 = [&](size_t offset, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            encoded[offset + i] = (char)(value >> (8 * i));
+        }
+    };
+    std::copy(BinaryConfig::magic, BinaryConfig::magic + 4, encoded.begin());
+    write_u32(4, BinaryConfig::version);
+    write_u32(8, (uint32_t)key_width);
+    write_u32(12, (uint32_t)lines.size());
+    size_t offset = BinaryConfig::header_size;
+    for (const ConfigLine& line : lines) {
+        std::copy(line.name.begin(), line.name.end(),
+                  encoded.begin() + offset);
+        write_u32(offset + key_width, (uint32_t)line.cutoff_freq);
+        encoded[offset + key_width + 4] = line.enabled ? 1 : 0;
+        encoded[offset + key_width + 5] = (char)line.order;
+        offset += entry_size;
+    }
+    return encoded;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <filter_design.h>
+
+// Cutoff steps offered by the dialog: MIN_CUTOFF..MAX_CUTOFF in units of
+// MULTIPLIER Hz
+constexpr int MULTIPLIER = 100;
+constexpr int MIN_CUTOFF = 0;
+constexpr int MAX_CUTOFF = 10000 / MULTIPLIER;
+
+// the table is designed for the rate every codec of interest runs at
+constexpr double table_sample_rate = 48000.0;
+constexpr int table_cutoff_steps = MAX_CUTOFF - MIN_CUTOFF + 1;
+constexpr int table_order_count = max_order / 2;
+
+// Trigonometry usable in constant expressions (the std functions are not
+// constexpr). The arguments seen here are small (the prewarped cutoff stays
+// below pi / 4 and the pole angles below pi), so a reduction to [0, pi / 2]
+// and a Taylor series run to convergence are accurate to about an ulp. The
+// series stops as soon as a term no longer changes the sum (about a dozen
+// terms at pi / 2), which keeps the table well inside the constant evaluation
+// limits of the compilers (MSVC's in particular).
+constexpr double constexpr_sin(double x) {
+    if (x > pi / 2) {
+        x = pi - x;
+    }
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 30; n++) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        if (sum + term == sum) {
+            break;
+        }
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double constexpr_cos(double x) { return constexpr_sin(pi / 2 - x); }
+
+constexpr double constexpr_tan(double x) {
+    return constexpr_sin(x) / constexpr_cos(x);
+}
+
+// Low pass sections for every dialog cutoff and every supported order,
+// designed at compile time. The table is read only data in the plugin, so
+// loading a config or moving the slider does no filter math at all.
+class CoefficientTable {
+   public:
+    SectionDesign sections[table_order_count][table_cutoff_steps]
+                          [max_section_count];
+};
+
+constexpr CoefficientTable make_coefficient_table() {
+    CoefficientTable table;
+    for (int o = 0; o < table_order_count; o++) {
+        int order = (o + 1) * 2;
+        // the pole angles only depend on the order
+        double damping[max_section_count] = {};
+        for (int i = 0; i < order / 2; i++) {
+            int pole_pair = section_pole_pair(order, i);
+            damping[i] = 2.0 * constexpr_sin(pole_pair_angle(order, pole_pair));
+        }
+        for (int step = 0; step < table_cutoff_steps; step++) {
+            double cutoff_freq = (MIN_CUTOFF + step) * MULTIPLIER;
+            double k = constexpr_tan(pi * cutoff_freq / table_sample_rate);
+            for (int i = 0; i < order / 2; i++) {
+                table.sections[o][step][i] =
+                    design_section(FilterType::LOW_PASS, k, damping[i]);
+            }
+        }
+    }
+    return table;
+}
+
+constexpr CoefficientTable coefficient_table = make_coefficient_table();
+
+// Copies the precomputed sections for the given parameters, if the table has
+// them. Anything else (hand edited cutoffs, high pass, other sample rates) is
+// left to design_butterworth.
+bool lookup_butterworth(FilterType type, int order, int cutoff_freq,
+                        double sample_rate, SectionDesign* sections) {
+    if (type != FilterType::LOW_PASS || !valid_order(order) ||
+        sample_rate != table_sample_rate || cutoff_freq % MULTIPLIER != 0) {
+        return false;
+    }
+    int step = cutoff_freq / MULTIPLIER - MIN_CUTOFF;
+    if (step < 0 || step >= table_cutoff_steps) {
+        return false;
+    }
+    const SectionDesign* designed =
+        coefficient_table.sections[order / 2 - 1][step];
+    std::copy(designed, designed + order / 2, sections);
+    return true;
+}
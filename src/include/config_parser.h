@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// One line of the config file: "<uid> <cutoff Hz> <enabled> [<order>]".
+class ConfigLine {
+   public:
+    // points into the parsed text
+    std::string_view name;
+    int cutoff_freq = 0;
+    bool enabled = false;
+    // 0 if the line has none (it was added later) or it is not a number
+    int order = 0;
+};
+
+class ConfigParseStats {
+   public:
+    size_t entries = 0;
+    size_t malformed = 0;
+    // 1 based, 0 if every line was well formed
+    size_t first_malformed_line = 0;
+};
+
+constexpr bool is_config_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// the next whitespace separated field of a line, empty at its end
+std::string_view next_config_field(std::string_view& line) {
+    size_t start = 0;
+    while (start < line.size() && is_config_space(line[start])) {
+        start++;
+    }
+    size_t end = start;
+    while (end < line.size() && !is_config_space(line[end])) {
+        end++;
+    }
+    std::string_view field = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return field;
+}
+
+// true if the whole field is a decimal int
+bool parse_config_int(std::string_view field, int& value) {
+    const char* last = field.data() + field.size();
+    auto result = std::from_chars(field.data(), last, value);
+    return result.ec == std::errc() && result.ptr == last && !field.empty();
+}
+
+// Parses a line without copying or allocating. Returns false if it is
+// malformed. The order is optional, so one that does not parse falls back to
+// the default rather than losing the line; fields after it are ignored, as
+// they always were.
+bool parse_config_line(std::string_view line, ConfigLine& parsed) {
+    parsed.name = next_config_field(line);
+    int enabled;
+    if (parsed.name.empty() ||
+        !parse_config_int(next_config_field(line), parsed.cutoff_freq) ||
+        parsed.cutoff_freq < 0 ||
+        !parse_config_int(next_config_field(line), enabled)) {
+        return false;
+    }
+    parsed.enabled = enabled != 0;
+    if (!parse_config_int(next_config_field(line), parsed.order)) {
+        parsed.order = 0;
+    }
+    return true;
+}
+
+// Calls on_line(const ConfigLine&) for every well formed line of a config,
+// in file order, skipping blank lines and counting the malformed ones.
+template <typename F>
+ConfigParseStats parse_config(std::string_view text, F on_line) {
+    ConfigParseStats stats;
+    ConfigLine parsed;
+    size_t line_number = 0;
+    while (!text.empty()) {
+        line_number++;
+        size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size()
+                                                         : end + 1);
+        std::string_view rest = line;
+        if (next_config_field(rest).empty()) {
+            continue;
+        }
+        if (parse_config_line(line, parsed)) {
+            stats.entries++;
+            on_line(parsed);
+        } else {
+            stats.malformed++;
+            if (stats.first_malformed_line == 0) {
+                stats.first_malformed_line = line_number;
+            }
+        }
+    }
+    return stats;
+}
+
+// The well formed lines of a config sorted by name, keeping only the first
+// line for each name. The file is written in name order, so the sort is
+// usually skipped.
+std::vector<ConfigLine> load_config_lines(std::string_view text,
+                                          ConfigParseStats& stats) {
+    std::vector<ConfigLine> lines;
+    stats = parse_config(
+        text, [&](const ConfigLine& line) { lines.push_back(line); });
+    auto by_name = [](const ConfigLine& a, const ConfigLine& b) {
+        return a.name < b.name;
+    };
+    if (!std::is_sorted(lines.begin(), lines.end(), by_name)) {
+        std::stable_sort(lines.begin(), lines.end(), by_name);
+    }
+    lines.erase(std::unique(lines.begin(), lines.end(),
+                            [](const ConfigLine& a, const ConfigLine& b) {
+                                return a.name == b.name;
+                            }),
+                lines.end());
+    return lines;
+}
+
+// Reads a whole file with a single read. Returns false if it cannot be
+// opened or read (a missing config is simply empty).
+bool read_config_file(const std::string& filename, std::string& contents) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::streamoff size = file.tellg();
+    if (size < 0) {
+        return false;
+    }
+    contents.resize((size_t)size);
+    file.seekg(0);
+    return file.read(&contents[0], size).gcount() == size;
+}
@@ -22,6 +22,7 @@
 
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QCheckBox>
+#include <QtWidgets/QComboBox>
 #include <QtWidgets/QDialog>
 #include <QtWidgets/QGridLayout>
 #include <QtWidgets/QLabel>
@@ -31,9 +32,6 @@
 #include <freq_cutoff.h>
 #include <ts3_log.h>
 
-constexpr int MULTIPLIER = 100;
-constexpr int MIN_CUTOFF = 0;
-constexpr int MAX_CUTOFF = 10000 / MULTIPLIER;
 constexpr int DEFAULT_CUTOFF = 4000 / MULTIPLIER;
 constexpr int STEP_INCREMENT = 100 / MULTIPLIER;
 constexpr int PAGE_INCREMENT = 1000 / MULTIPLIER;
@@ -44,7 +42,9 @@ class ConfigureCutoffDialog : public QDialog {
     QLabel* value_label;
     QSlider* slider;
     QCheckBox* enabled;
-    map<const string, FilterConf> original_confs;
+    QComboBox* order;
+    // to go back to on cancel
+    std::optional<FilterConf> original_conf;
 
    public:
     ConfigureCutoffDialog(const string dname, const string uname,
@@ -67,12 +67,19 @@ class ConfigureCutoffDialog : public QDialog {
 
         layout->addWidget(slider, 1, 0, 1, 7);
 
+        layout->addWidget(new QLabel("Filter order"), 2, 0, 1, 3);
+        order = new QComboBox();
+        for (int o = 2; o <= max_order; o += 2) {
+            order->addItem(std::to_string(o).c_str());
+        }
+        layout->addWidget(order, 2, 3, 1, 6);
+
         QPushButton* cancel = new QPushButton("Cancel");
-        layout->addWidget(cancel, 2, 0, 1, 3);
+        layout->addWidget(cancel, 3, 0, 1, 3);
         QPushButton* remove = new QPushButton("Remove");
-        layout->addWidget(remove, 2, 3, 1, 3);
+        layout->addWidget(remove, 3, 3, 1, 3);
         QPushButton* apply = new QPushButton("Apply");
-        layout->addWidget(apply, 2, 6, 1, 3);
+        layout->addWidget(apply, 3, 6, 1, 3);
 
         QObject::connect(slider, &QSlider::valueChanged, this,
                          &ConfigureCutoffDialog::value_changed);
@@ -83,14 +90,16 @@ class ConfigureCutoffDialog : public QDialog {
         QObject::connect(remove, &QPushButton::released, this,
                          &ConfigureCutoffDialog::remove);
 
-        original_confs = *app_filter_group.load_atomic();
-        if (original_confs.count(uname) > 0) {
-            FilterConf& conf = original_confs.at(uname);
-            enabled->setChecked(conf.enabled);
-            slider->setValue(conf.coefficients.cutoff_freq / MULTIPLIER);
+        ConfMap current_confs = app_filter_group.load_confs();
+        if (const FilterConf* conf = current_confs.find(uname)) {
+            original_conf = *conf;
+            enabled->setChecked(conf->enabled);
+            slider->setValue(conf->coefficients->cutoff_freq / MULTIPLIER);
+            set_order(conf->coefficients->order);
         } else {
             enabled->setChecked(false);
             slider->setValue(DEFAULT_CUTOFF);
+            set_order(default_order);
         }
 
         update_label();
@@ -99,26 +108,29 @@ class ConfigureCutoffDialog : public QDialog {
                          &ConfigureCutoffDialog::apply_temporary);
         QObject::connect(enabled, &QCheckBox::stateChanged, this,
                          &ConfigureCutoffDialog::apply_temporary);
+        QObject::connect(
+            order,
+            static_cast<void (QComboBox::*)(int)>(
+                &QComboBox::currentIndexChanged),
+            this, &ConfigureCutoffDialog::apply_temporary);
     }
 
     int slider_cutoff_value() { return slider->value() * MULTIPLIER; }
 
+    // the combo box lists the even orders starting from 2
+    int selected_order() { return (order->currentIndex() + 1) * 2; }
+
+    void set_order(int value) { order->setCurrentIndex(value / 2 - 1); }
+
     void update_label() {
         value_label->setText(
             (std::to_string(slider_cutoff_value()) + " Hz").c_str());
     }
 
     void apply_current_state() {
-        map<const string, FilterConf> updated_confs =
-            *app_filter_group.load_atomic();
-        FilterConf new_conf(enabled->isChecked(), slider_cutoff_value());
-        if (updated_confs.count(uname) > 0) {
-            updated_confs.at(uname) = new_conf;
-        } else {
-            updated_confs.emplace(uname, new_conf);
-        }
-
-        app_filter_group.store_atomic(updated_confs);
+        FilterConf new_conf(enabled->isChecked(), slider_cutoff_value(),
+                            selected_order());
+        app_filter_group.update_conf(uname, &new_conf);
     }
 
     void apply_temporary() { apply_current_state(); }
@@ -128,14 +140,14 @@ class ConfigureCutoffDialog : public QDialog {
     }
 
     void cancel() {
-        app_filter_group.store_atomic(original_confs);
+        app_filter_group.update_conf(
+            uname, original_conf ? &*original_conf : nullptr);
         app_filter_group.persist();
         this->close();
     }
 
     void remove() {
-        original_confs.erase(uname);
-        app_filter_group.store_atomic(original_confs);
+        app_filter_group.update_conf(uname, nullptr);
         app_filter_group.persist();
         this->close();
     }
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+#include <background_worker.h>
+#include <ts3_log.h>
+
+// Logging for the audio thread. log_info formats the message (allocating) and
+// calls into the client library synchronously, neither of which belongs in the
+// playback callback. Here the callback only posts a fixed size record (the
+// format and its integer arguments) to the plugin's background worker, which
+// formats it and passes it on to logMessage. When the worker's queue is full
+// the record is dropped and counted, and the count is reported with the next
+// record that gets through.
+//
+// Records refer back to the log, so it has to outlive the worker's last
+// drain.
+class DeferredLog {
+   public:
+    static constexpr int max_args = 4;
+
+   private:
+    class Record {
+       public:
+        // a string literal -- it must outlive the record
+        const char* format;
+        LogLevel level;
+        int args[max_args];
+    };
+
+    const TS3Functions& ts3_functions;
+    BackgroundWorker& worker;
+    std::atomic<uint64_t> dropped{0};
+
+    void report_dropped() {
+        uint64_t count = dropped.exchange(0, std::memory_order_relaxed);
+        if (count > 0) {
+            log_error(ts3_functions,
+                      "%llu log messages from the audio thread were dropped",
+                      (unsigned long long)count);
+        }
+    }
+
+    // on the worker
+    void write(const Record& record) {
+        char message[log_buffer_size];
+        format_into(message, sizeof(message), record.format, record.args[0],
+                    record.args[1], record.args[2], record.args[3]);
+        ts3_functions.logMessage(message, record.level, freq_cutoff_name(), 0);
+        report_dropped();
+    }
+
+   public:
+    DeferredLog(const TS3Functions& ts3_functions, BackgroundWorker& worker)
+        : ts3_functions(ts3_functions), worker(worker) {}
+
+    DeferredLog(const DeferredLog&) = delete;
+    DeferredLog& operator=(const DeferredLog&) = delete;
+
+    // reports what was dropped after the last record got through
+    ~DeferredLog() { report_dropped(); }
+
+    // Queues a message without locking, allocating or formatting. The format
+    // must be a string literal whose conversions all take an int.
+    template <typename... Args>
+    void info(const char* format, Args... args) {
+        push(LogLevel::LogLevel_INFO, format, args...);
+    }
+
+    template <typename... Args>
+    void push(LogLevel level, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= max_args, "too many log arguments");
+        static_assert((std::is_integral<Args>::value && ...),
+                      "only integer log arguments can be deferred");
+
+        Record record;
+        record.format = format;
+        record.level = level;
+        int values[max_args + 1] = {(int)args...};
+        std::copy(values, values + max_args, record.args);
+        DeferredLog* log = this;
+        if (!worker.post([log, record] { log->write(record); })) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
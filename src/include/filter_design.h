@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// highest order of the butterworth filter -- the filter state and coefficients
+// are sized for it
+constexpr const int max_order = 8;
+// the filter is run as a cascade of second order sections (biquads), one per
+// conjugate pole pair
+constexpr const int max_section_count = max_order / 2;
+
+constexpr double pi = 3.14159265358979323846;
+
+// only even orders are supported (each section holds a conjugate pole pair)
+constexpr bool valid_order(int order) {
+    return order >= 2 && order <= max_order && order % 2 == 0;
+}
+
+enum class FilterType { LOW_PASS, HIGH_PASS };
+
+// a single designed second order section, normalized so that a0 = 1
+class SectionDesign {
+   public:
+    double b0 = 1;
+    double b1 = 0;
+    double b2 = 0;
+    double a1 = 0;
+    double a2 = 0;
+};
+
+// Angle of a conjugate pole pair of the analog butterworth prototype, whose
+// damping (2 * zeta) is 2 * sin(angle). Pole pair 0 has the least damping
+// (highest Q).
+constexpr double pole_pair_angle(int order, int pole_pair) {
+    return pi * (2 * pole_pair + 1) / (2.0 * order);
+}
+
+// The section order is reversed relative to the pole pairs, so the sections
+// run from the lowest to the highest Q.
+constexpr int section_pole_pair(int order, int section) {
+    return order / 2 - 1 - section;
+}
+
+// Bilinear transform of one prototype pole pair, where k is the prewarped
+// tan(pi * cutoff / sample rate). Split out so that the compile time table can
+// run it with its own trigonometry.
+constexpr SectionDesign design_section(FilterType type, double k,
+                                       double damping) {
+    SectionDesign section;
+    if (k == 0) {
+        // At 0 Hz the poles land on z = 1, where the section is only
+        // marginally stable and any leftover state (e.g. after a retarget)
+        // would ramp forever. Use the limits instead: silence for a low pass,
+        // pass through for a high pass.
+        if (type == FilterType::LOW_PASS) {
+            section.b0 = 0;
+        }
+        return section;
+    }
+    double norm = 1.0 / (1.0 + damping * k + k * k);
+    if (type == FilterType::LOW_PASS) {
+        section.b0 = k * k * norm;
+        section.b1 = 2.0 * k * k * norm;
+        section.b2 = k * k * norm;
+    } else {
+        section.b0 = norm;
+        section.b1 = -2.0 * norm;
+        section.b2 = norm;
+    }
+    section.a1 = 2.0 * (k * k - 1.0) * norm;
+    section.a2 = (1.0 - damping * k + k * k) * norm;
+    return section;
+}
+
+// Multiplies out order / 2 sections, one quadratic at a time, into the
+// equivalent direct form polynomial of order + 1 coefficients.
+void expand_sections(const SectionDesign* sections, int order, double* b,
+                     double* a) {
+    std::fill(b, b + order + 1, 0.0);
+    std::fill(a, a + order + 1, 0.0);
+    b[0] = 1.0;
+    a[0] = 1.0;
+    for (int i = 0; i < order / 2; i++) {
+        const SectionDesign& section = sections[i];
+        for (int j = 2 * i + 2; j >= 0; j--) {
+            double new_b = section.b0 * b[j];
+            double new_a = a[j];
+            if (j >= 1) {
+                new_b += section.b1 * b[j - 1];
+                new_a += section.a1 * a[j - 1];
+            }
+            if (j >= 2) {
+                new_b += section.b2 * b[j - 2];
+                new_a += section.a2 * a[j - 2];
+            }
+            b[j] = new_b;
+            a[j] = new_a;
+        }
+    }
+}
+
+// Designs a butterworth filter as order / 2 second order sections, and
+// (optionally) the equivalent direct form polynomial of order + 1
+// coefficients. Everything is written into the caller's arrays -- there is no
+// allocation and no shared state, so this is safe to call from the audio
+// thread or from several threads at once. Returns false and leaves the arrays
+// untouched when the parameters cannot be designed.
+//
+// The sections are the bilinear transform (with prewarping) of the analog
+// butterworth prototype, one conjugate pole pair each. All zeros sit at
+// z = -1 (low pass) or z = 1 (high pass), so each section gets the numerator
+// (1 +- z^-1)^2 and its own gain, which keeps the gain of every intermediate
+// stage at unity in the pass band. The sections are ordered from the lowest
+// to the highest Q to limit the peaking seen by the earlier stages.
+bool design_butterworth(FilterType type, int order, double cutoff_freq,
+                        double sample_rate, SectionDesign* sections,
+                        double* b = nullptr, double* a = nullptr) {
+    if (!valid_order(order) || !(sample_rate > 0) || !(cutoff_freq >= 0) ||
+        !(cutoff_freq < sample_rate / 2.0)) {
+        return false;
+    }
+
+    double k = std::tan(pi * cutoff_freq / sample_rate);
+    for (int i = 0; i < order / 2; i++) {
+        double damping = 2.0 * std::sin(pole_pair_angle(
+                                   order, section_pole_pair(order, i)));
+        sections[i] = design_section(type, k, damping);
+    }
+
+    if (b != nullptr && a != nullptr) {
+        expand_sections(sections, order, b, a);
+    }
+    return true;
+}
@@ -0,0 +1,802 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#include <freq_cutoff.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define FREQ_CUTOFF_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// msvc allows any intrinsic without per function target flags
+#define FREQ_CUTOFF_TARGET(arch)
+#else
+#define FREQ_CUTOFF_TARGET(arch) __attribute__((target(arch)))
+#endif
+#endif
+
+class CpuFeatures {
+   public:
+    bool sse2 = false;
+    bool avx2 = false;
+
+    CpuFeatures() {
+#if defined(FREQ_CUTOFF_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        sse2 = (info[3] & (1 << 26)) != 0;
+        bool os_saves_ymm = (info[2] & (1 << 27)) != 0 &&
+                            (info[2] & (1 << 28)) != 0 &&
+                            (_xgetbv(0) & 6) == 6;
+        if (os_saves_ymm && max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#elif defined(FREQ_CUTOFF_X86)
+        __builtin_cpu_init();
+        sse2 = __builtin_cpu_supports("sse2");
+        avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+};
+
+#ifdef FREQ_CUTOFF_DIRECT_FORM
+// The original kernel: the whole filter as a single direct form polynomial.
+// Kept as a reference for the biquad cascade, but it becomes unstable at low
+// cutoffs (below a few hundred Hz).
+template <int Order>
+void filter_direct_form(const ButterworthCoefficients& coefficients,
+                        ButterworthFilter& filter, short* samples,
+                        int sample_count, int channels) {
+    for (int c = 0; c < channels; c++) {
+        ButterworthChannelFilter& channel_filter = filter.channel_filters[c];
+        for (int s = 0; s < sample_count; s++) {
+            // x_history[-i] and y_history[-i] hold x[n - i] and y[n - i]
+            const double* x_history =
+                channel_filter.x + channel_filter.index + Order;
+            const double* y_history =
+                channel_filter.y + channel_filter.index + Order;
+            double new_x = (double)samples[s * channels + c];
+            double new_y = (coefficients.b[0]) * new_x;
+            for (int i = 1; i <= Order; i++) {
+                new_y += (coefficients.b[i] * x_history[-i]);
+                new_y -= (coefficients.a[i] * y_history[-i]);
+            }
+
+            channel_filter.x[channel_filter.index] = new_x;
+            channel_filter.x[channel_filter.index + Order] = new_x;
+            channel_filter.y[channel_filter.index] = new_y;
+            channel_filter.y[channel_filter.index + Order] = new_y;
+            samples[s * channels + c] = (short)new_y;
+            channel_filter.index++;
+            if (channel_filter.index == Order) {
+                channel_filter.index = 0;
+            }
+        }
+    }
+}
+#endif
+
+short saturate_sample(double y) {
+    if (y >= 32767.0) {
+        return 32767;
+    } else if (y <= -32768.0) {
+        return -32768;
+    }
+    return (short)y;
+}
+
+short saturate_sample(float y) {
+    if (y >= 32767.0f) {
+        return 32767;
+    } else if (y <= -32768.0f) {
+        return -32768;
+    }
+    return (short)y;
+}
+
+// Flushes denormals to zero (FTZ) and treats denormal inputs as zero (DAZ)
+// for as long as it is alive. When a speaker goes quiet the filter state
+// decays towards zero, and once it reaches the denormal range every
+// operation on it can be 10-100x slower. Anything that small is far below one
+// bit of the 16 bit output, so flushing it does not change what we play. The
+// previous mode is restored so the client's own code is unaffected.
+class DenormalGuard {
+#ifdef FREQ_CUTOFF_X86
+    unsigned int saved_csr;
+
+   public:
+    DenormalGuard() : saved_csr(_mm_getcsr()) {
+        // bit 15 is flush to zero, bit 6 is denormals are zero
+        _mm_setcsr(saved_csr | 0x8040);
+    }
+
+    ~DenormalGuard() { _mm_setcsr(saved_csr); }
+#endif
+};
+
+// one sample through one transposed direct form II section
+inline filter_real biquad_section(const BiquadCoefficients& coefs,
+                                  BiquadState& state, filter_real x) {
+    filter_real y = coefs.b0 * x + state.z1;
+    state.z1 = coefs.b1 * x - coefs.a1 * y + state.z2;
+    state.z2 = coefs.b2 * x - coefs.a2 * y;
+    return y;
+}
+
+#ifndef FREQ_CUTOFF_FIXED
+// Runs each channel through the cascade of second order sections, each in
+// transposed direct form II. The kernels are specialized on the filter order
+// and the channel count so the section and channel loops have constant bounds
+// and can be unrolled. The
+// coefficients and state are copied into locals for the duration of the frame
+// -- otherwise every store to the state could alias them.
+template <int Order, int Channels>
+void filter_biquad_cascade(const ButterworthCoefficients& coefficients,
+                           ButterworthFilter& filter, short* samples,
+                           int sample_count, [[maybe_unused]] int channels) {
+    constexpr int sections = Order / 2;
+    constexpr int stride = Channels;
+    BiquadCoefficients coefs[sections];
+    std::copy(coefficients.sections, coefficients.sections + sections, coefs);
+    for (int c = 0; c < stride; c++) {
+        ButterworthChannelFilter& channel_filter = filter.channel_filters[c];
+        BiquadState state[sections];
+        std::copy(channel_filter.sections, channel_filter.sections + sections,
+                  state);
+        for (int s = 0; s < sample_count; s++) {
+            filter_real y = (filter_real)samples[s * stride + c];
+            for (int i = 0; i < sections; i++) {
+                y = biquad_section(coefs[i], state[i], y);
+            }
+            samples[s * stride + c] = saturate_sample(y);
+        }
+        std::copy(state, state + sections, channel_filter.sections);
+    }
+}
+
+// Retargeting kernel: the cascade with every coefficient (and dry share)
+// moving linearly from start to end over the block, reaching end on the last
+// sample. Both must have the same order. It only runs in the frame after a
+// cutoff change, so it is kept simple rather than specialized.
+void filter_biquad_ramp(const ButterworthCoefficients& start,
+                        const ButterworthCoefficients& end,
+                        ButterworthFilter& filter, short* samples,
+                        int sample_count, int channels) {
+    const int sections = end.section_count();
+    for (int c = 0; c < channels; c++) {
+        ButterworthChannelFilter& channel_filter = filter.channel_filters[c];
+        for (int s = 0; s < sample_count; s++) {
+            filter_real t = (filter_real)(s + 1) / sample_count;
+            filter_real y = (filter_real)samples[s * channels + c];
+            for (int i = 0; i < sections; i++) {
+                const BiquadCoefficients& from = start.sections[i];
+                const BiquadCoefficients& to = end.sections[i];
+                BiquadCoefficients coefs;
+                coefs.b0 = from.b0 + (to.b0 - from.b0) * t;
+                coefs.b1 = from.b1 + (to.b1 - from.b1) * t;
+                coefs.b2 = from.b2 + (to.b2 - from.b2) * t;
+                coefs.a1 = from.a1 + (to.a1 - from.a1) * t;
+                coefs.a2 = from.a2 + (to.a2 - from.a2) * t;
+                filter_real x = y;
+                y = biquad_section(coefs, channel_filter.sections[i], x);
+                filter_real dry =
+                    start.dry[i] + (end.dry[i] - start.dry[i]) * t;
+                y += dry * (x - y);
+            }
+            samples[s * channels + c] = saturate_sample(y);
+        }
+    }
+}
+#else
+// one sample through one fixed point direct form I section: the five products
+// are accumulated in 64 bits and truncated back to the int32 signal with error
+// feedback
+inline int32_t fixed_section(const FixedBiquadCoefficients& coefs,
+                             FixedBiquadState& state, int32_t x) {
+    int64_t acc = (int64_t)coefs.b0 * x + (int64_t)coefs.b1 * state.x1 +
+                  (int64_t)coefs.b2 * state.x2 - (int64_t)coefs.a1 * state.y1 -
+                  (int64_t)coefs.a2 * state.y2 + state.error;
+    int32_t y = (int32_t)(acc >> fixed_coefficient_shift);
+    state.error = acc - (int64_t)y * ((int64_t)1 << fixed_coefficient_shift);
+    state.x2 = state.x1;
+    state.x1 = x;
+    state.y2 = state.y1;
+    state.y1 = y;
+    return y;
+}
+
+// a sample scaled up to the signal format (multiplied rather than shifted,
+// since shifting a negative value left is undefined)
+int32_t fixed_input_sample(short x) {
+    return (int32_t)x * (1 << fixed_signal_shift);
+}
+
+short fixed_output_sample(int32_t y) {
+    constexpr int64_t output_round = (int64_t)1 << (fixed_signal_shift - 1);
+    int64_t out = ((int64_t)y + output_round) >> fixed_signal_shift;
+    return (short)std::max<int64_t>(-32768, std::min<int64_t>(32767, out));
+}
+
+// Integer cascade: each section accumulates its five products in 64 bits and
+// truncates back to the int32 signal with error feedback. Samples never leave
+// the integer domain.
+template <int Order, int Channels>
+void filter_fixed_cascade(const ButterworthCoefficients& coefficients,
+                          ButterworthFilter& filter, short* samples,
+                          int sample_count, [[maybe_unused]] int channels) {
+    constexpr int sections = Order / 2;
+    constexpr int stride = Channels;
+    FixedBiquadCoefficients coefs[sections];
+    std::copy(coefficients.fixed_sections,
+              coefficients.fixed_sections + sections, coefs);
+    for (int c = 0; c < stride; c++) {
+        ButterworthChannelFilter& channel_filter = filter.channel_filters[c];
+        FixedBiquadState state[sections];
+        std::copy(channel_filter.fixed_sections,
+                  channel_filter.fixed_sections + sections, state);
+        for (int s = 0; s < sample_count; s++) {
+            int32_t y = fixed_input_sample(samples[s * stride + c]);
+            for (int i = 0; i < sections; i++) {
+                y = fixed_section(coefs[i], state[i], y);
+            }
+            samples[s * stride + c] = fixed_output_sample(y);
+        }
+        std::copy(state, state + sections, channel_filter.fixed_sections);
+    }
+}
+
+// the fixed point counterpart of filter_biquad_ramp
+void filter_fixed_ramp(const ButterworthCoefficients& start,
+                       const ButterworthCoefficients& end,
+                       ButterworthFilter& filter, short* samples,
+                       int sample_count, int channels) {
+    const int sections = end.section_count();
+    for (int c = 0; c < channels; c++) {
+        ButterworthChannelFilter& channel_filter = filter.channel_filters[c];
+        for (int s = 0; s < sample_count; s++) {
+            int32_t y = fixed_input_sample(samples[s * channels + c]);
+            for (int i = 0; i < sections; i++) {
+                const FixedBiquadCoefficients& from = start.fixed_sections[i];
+                const FixedBiquadCoefficients& to = end.fixed_sections[i];
+                auto ramp = [&](int32_t a, int32_t b) {
+                    return a + (int32_t)(((int64_t)b - a) * (s + 1) /
+                                         sample_count);
+                };
+                FixedBiquadCoefficients coefs;
+                coefs.b0 = ramp(from.b0, to.b0);
+                coefs.b1 = ramp(from.b1, to.b1);
+                coefs.b2 = ramp(from.b2, to.b2);
+                coefs.a1 = ramp(from.a1, to.a1);
+                coefs.a2 = ramp(from.a2, to.a2);
+                int32_t x = y;
+                y = fixed_section(coefs, channel_filter.fixed_sections[i], x);
+                int64_t dry = ramp(start.fixed_dry[i], end.fixed_dry[i]);
+                y += (int32_t)(((int64_t)x - y) * dry >>
+                               fixed_coefficient_shift);
+            }
+            samples[s * channels + c] = fixed_output_sample(y);
+        }
+    }
+}
+#endif
+
+// the fixed point build keeps no floating point state for these to run on
+#if defined(FREQ_CUTOFF_X86) && !defined(FREQ_CUTOFF_FIXED)
+
+// Frames longer than this (per channel) are filtered in several passes, which
+// bounds the conversion buffers kept on the stack. Every pass leaves the
+// filter state fully up to date, so the split does not change the output.
+constexpr int simd_block = 1024;
+
+// A single channel has no independent lanes, so the mono (and single
+// precision stereo) kernels pipeline the sections of the cascade instead. Lane
+// i holds section i and at step t works on sample t - i, taking as input the
+// output lane i - 1 produced in the previous step. The first and last
+// (pipeline_lanes - 1) steps only have some lanes working on real samples --
+// the state of the other lanes is left untouched. Missing sections are padded
+// with pass-through sections.
+constexpr int pipeline_lanes = 4;
+
+#ifdef FREQ_CUTOFF_FLOAT
+
+// Sign extends and converts n shorts to floats, eight at a time.
+FREQ_CUTOFF_TARGET("sse2")
+void convert_to_float(const short* in, float* out, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+    }
+    for (; i < n; i++) {
+        out[i] = (float)in[i];
+    }
+}
+
+// Truncates n floats back to shorts with saturation, eight at a time.
+FREQ_CUTOFF_TARGET("sse2")
+void convert_to_short(const float* in, short* out, int n) {
+    const __m128 max = _mm_set1_ps(32767.0f);
+    const __m128 min = _mm_set1_ps(-32768.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 lo = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + i), max), min);
+        __m128 hi = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + i + 4), max), min);
+        _mm_storeu_si128((__m128i*)(out + i),
+                         _mm_packs_epi32(_mm_cvttps_epi32(lo),
+                                         _mm_cvttps_epi32(hi)));
+    }
+    for (; i < n; i++) {
+        out[i] = saturate_sample(in[i]);
+    }
+}
+
+// In single precision four sections fit into a plain SSE register, so the
+// mono pipeline needs nothing newer than SSE2.
+template <int Order>
+FREQ_CUTOFF_TARGET("sse2")
+void filter_mono_sse2(const ButterworthCoefficients& coefficients,
+                      ButterworthFilter& filter, short* samples,
+                      int sample_count) {
+    constexpr int sections = Order / 2;
+    static_assert(sections <= pipeline_lanes,
+                  "the mono pipeline needs one lane per section");
+    ButterworthChannelFilter& channel_filter = filter.channel_filters[0];
+
+    alignas(16) float b0[pipeline_lanes] = {1, 1, 1, 1};
+    alignas(16) float b1[pipeline_lanes] = {0};
+    alignas(16) float b2[pipeline_lanes] = {0};
+    alignas(16) float a1[pipeline_lanes] = {0};
+    alignas(16) float a2[pipeline_lanes] = {0};
+    alignas(16) float z1[pipeline_lanes] = {0};
+    alignas(16) float z2[pipeline_lanes] = {0};
+    for (int i = 0; i < sections; i++) {
+        const BiquadCoefficients& section = coefficients.sections[i];
+        b0[i] = section.b0;
+        b1[i] = section.b1;
+        b2[i] = section.b2;
+        a1[i] = section.a1;
+        a2[i] = section.a2;
+        z1[i] = channel_filter.sections[i].z1;
+        z2[i] = channel_filter.sections[i].z2;
+    }
+    const __m128 vb0 = _mm_load_ps(b0);
+    const __m128 vb1 = _mm_load_ps(b1);
+    const __m128 vb2 = _mm_load_ps(b2);
+    const __m128 va1 = _mm_load_ps(a1);
+    const __m128 va2 = _mm_load_ps(a2);
+    __m128 vz1 = _mm_load_ps(z1);
+    __m128 vz2 = _mm_load_ps(z2);
+    __m128 y = _mm_setzero_ps();
+
+    alignas(16) float buffer[simd_block];
+    convert_to_float(samples, buffer, sample_count);
+    constexpr int latency = pipeline_lanes - 1;
+    for (int t = 0; t < sample_count + latency; t++) {
+        float input = t < sample_count ? buffer[t] : 0.0f;
+        __m128 shifted =
+            _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(y), 4));
+        __m128 x = _mm_move_ss(shifted, _mm_set_ss(input));
+        y = _mm_add_ps(_mm_mul_ps(vb0, x), vz1);
+        __m128 new_z1 = _mm_add_ps(
+            _mm_sub_ps(_mm_mul_ps(vb1, x), _mm_mul_ps(va1, y)), vz2);
+        __m128 new_z2 = _mm_sub_ps(_mm_mul_ps(vb2, x), _mm_mul_ps(va2, y));
+        if (t < latency || t >= sample_count) {
+            int active[pipeline_lanes];
+            for (int i = 0; i < pipeline_lanes; i++) {
+                active[i] = (t - i >= 0 && t - i < sample_count) ? -1 : 0;
+            }
+            __m128 mask = _mm_castsi128_ps(
+                _mm_set_epi32(active[3], active[2], active[1], active[0]));
+            vz1 = _mm_or_ps(_mm_and_ps(mask, new_z1), _mm_andnot_ps(mask, vz1));
+            vz2 = _mm_or_ps(_mm_and_ps(mask, new_z2), _mm_andnot_ps(mask, vz2));
+        } else {
+            vz1 = new_z1;
+            vz2 = new_z2;
+        }
+        if (t >= latency) {
+            buffer[t - latency] =
+                _mm_cvtss_f32(_mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+    }
+    convert_to_short(buffer, samples, sample_count);
+
+    _mm_store_ps(z1, vz1);
+    _mm_store_ps(z2, vz2);
+    for (int i = 0; i < sections; i++) {
+        channel_filter.sections[i].z1 = z1[i];
+        channel_filter.sections[i].z2 = z2[i];
+    }
+}
+
+// Stereo in single precision: the same section pipeline, with each 64 bit
+// slot of an AVX2 register holding one section for both channels.
+template <int Order>
+FREQ_CUTOFF_TARGET("avx2")
+void filter_stereo_avx2(const ButterworthCoefficients& coefficients,
+                        ButterworthFilter& filter, short* samples,
+                        int sample_count) {
+    constexpr int sections = Order / 2;
+    static_assert(sections <= pipeline_lanes,
+                  "the stereo pipeline needs one lane per section");
+    constexpr int width = 2 * pipeline_lanes;
+    ButterworthChannelFilter& left = filter.channel_filters[0];
+    ButterworthChannelFilter& right = filter.channel_filters[1];
+
+    alignas(32) float b0[width] = {1, 1, 1, 1, 1, 1, 1, 1};
+    alignas(32) float b1[width] = {0};
+    alignas(32) float b2[width] = {0};
+    alignas(32) float a1[width] = {0};
+    alignas(32) float a2[width] = {0};
+    alignas(32) float z1[width] = {0};
+    alignas(32) float z2[width] = {0};
+    for (int i = 0; i < sections; i++) {
+        const BiquadCoefficients& section = coefficients.sections[i];
+        b0[2 * i] = b0[2 * i + 1] = section.b0;
+        b1[2 * i] = b1[2 * i + 1] = section.b1;
+        b2[2 * i] = b2[2 * i + 1] = section.b2;
+        a1[2 * i] = a1[2 * i + 1] = section.a1;
+        a2[2 * i] = a2[2 * i + 1] = section.a2;
+        z1[2 * i] = left.sections[i].z1;
+        z1[2 * i + 1] = right.sections[i].z1;
+        z2[2 * i] = left.sections[i].z2;
+        z2[2 * i + 1] = right.sections[i].z2;
+    }
+    const __m256 vb0 = _mm256_load_ps(b0);
+    const __m256 vb1 = _mm256_load_ps(b1);
+    const __m256 vb2 = _mm256_load_ps(b2);
+    const __m256 va1 = _mm256_load_ps(a1);
+    const __m256 va2 = _mm256_load_ps(a2);
+    __m256 vz1 = _mm256_load_ps(z1);
+    __m256 vz2 = _mm256_load_ps(z2);
+    __m256 y = _mm256_setzero_ps();
+
+    // only the padding pair is read before it is written
+    alignas(32) float buffer[2 * simd_block + 2];
+    convert_to_float(samples, buffer, 2 * sample_count);
+    buffer[2 * sample_count] = 0.0f;
+    buffer[2 * sample_count + 1] = 0.0f;
+    constexpr int latency = pipeline_lanes - 1;
+    for (int t = 0; t < sample_count + latency; t++) {
+        // past the end the pipeline is fed the zeroed padding pair
+        const double* pair =
+            (const double*)(buffer + 2 * std::min(t, sample_count));
+        __m256 shifted = _mm256_castpd_ps(
+            _mm256_permute4x64_pd(_mm256_castps_pd(y), 0x90));
+        __m256 x = _mm256_blend_ps(
+            shifted, _mm256_castpd_ps(_mm256_broadcast_sd(pair)), 0x03);
+        y = _mm256_add_ps(_mm256_mul_ps(vb0, x), vz1);
+        __m256 new_z1 = _mm256_add_ps(
+            _mm256_sub_ps(_mm256_mul_ps(vb1, x), _mm256_mul_ps(va1, y)), vz2);
+        __m256 new_z2 =
+            _mm256_sub_ps(_mm256_mul_ps(vb2, x), _mm256_mul_ps(va2, y));
+        if (t < latency || t >= sample_count) {
+            long long active[pipeline_lanes];
+            for (int i = 0; i < pipeline_lanes; i++) {
+                active[i] = (t - i >= 0 && t - i < sample_count) ? -1 : 0;
+            }
+            __m256 mask = _mm256_castsi256_ps(_mm256_set_epi64x(
+                active[3], active[2], active[1], active[0]));
+            vz1 = _mm256_blendv_ps(vz1, new_z1, mask);
+            vz2 = _mm256_blendv_ps(vz2, new_z2, mask);
+        } else {
+            vz1 = new_z1;
+            vz2 = new_z2;
+        }
+        if (t >= latency) {
+            _mm_storeh_pi((__m64*)(buffer + 2 * (t - latency)),
+                          _mm256_extractf128_ps(y, 1));
+        }
+    }
+    convert_to_short(buffer, samples, 2 * sample_count);
+
+    _mm256_store_ps(z1, vz1);
+    _mm256_store_ps(z2, vz2);
+    for (int i = 0; i < sections; i++) {
+        left.sections[i].z1 = z1[2 * i];
+        right.sections[i].z1 = z1[2 * i + 1];
+        left.sections[i].z2 = z2[2 * i];
+        right.sections[i].z2 = z2[2 * i + 1];
+    }
+}
+
+#else
+
+// Sign extends and converts n shorts to doubles, eight at a time.
+FREQ_CUTOFF_TARGET("sse2")
+void convert_to_double(const short* in, double* out, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_pd(out + i, _mm_cvtepi32_pd(lo));
+        _mm_storeu_pd(out + i + 2, _mm_cvtepi32_pd(_mm_srli_si128(lo, 8)));
+        _mm_storeu_pd(out + i + 4, _mm_cvtepi32_pd(hi));
+        _mm_storeu_pd(out + i + 6, _mm_cvtepi32_pd(_mm_srli_si128(hi, 8)));
+    }
+    for (; i < n; i++) {
+        out[i] = (double)in[i];
+    }
+}
+
+// Truncates n doubles back to shorts with saturation, eight at a time. The
+// clamp before the conversion keeps the result identical to saturate_sample.
+FREQ_CUTOFF_TARGET("sse2")
+void convert_to_short(const double* in, short* out, int n) {
+    const __m128d max = _mm_set1_pd(32767.0);
+    const __m128d min = _mm_set1_pd(-32768.0);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v[4];
+        for (int j = 0; j < 4; j++) {
+            __m128d d = _mm_loadu_pd(in + i + 2 * j);
+            v[j] = _mm_cvttpd_epi32(_mm_max_pd(_mm_min_pd(d, max), min));
+        }
+        __m128i lo = _mm_unpacklo_epi64(v[0], v[1]);
+        __m128i hi = _mm_unpacklo_epi64(v[2], v[3]);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    for (; i < n; i++) {
+        out[i] = saturate_sample(in[i]);
+    }
+}
+
+// Stereo: the two channels run in the two lanes of an SSE2 register, so every
+// section of the cascade is evaluated for both channels at once.
+template <int Order>
+FREQ_CUTOFF_TARGET("sse2")
+void filter_stereo_sse2(const ButterworthCoefficients& coefficients,
+                        ButterworthFilter& filter, short* samples,
+                        int sample_count) {
+    ButterworthChannelFilter& left = filter.channel_filters[0];
+    ButterworthChannelFilter& right = filter.channel_filters[1];
+
+    constexpr int sections = Order / 2;
+    __m128d b0[sections], b1[sections], b2[sections];
+    __m128d a1[sections], a2[sections];
+    __m128d z1[sections], z2[sections];
+    for (int i = 0; i < sections; i++) {
+        const BiquadCoefficients& section = coefficients.sections[i];
+        b0[i] = _mm_set1_pd(section.b0);
+        b1[i] = _mm_set1_pd(section.b1);
+        b2[i] = _mm_set1_pd(section.b2);
+        a1[i] = _mm_set1_pd(section.a1);
+        a2[i] = _mm_set1_pd(section.a2);
+        z1[i] = _mm_set_pd(right.sections[i].z1, left.sections[i].z1);
+        z2[i] = _mm_set_pd(right.sections[i].z2, left.sections[i].z2);
+    }
+
+    alignas(16) double buffer[2 * simd_block];
+    int n = 2 * sample_count;
+    convert_to_double(samples, buffer, n);
+    for (int s = 0; s < n; s += 2) {
+        __m128d y = _mm_load_pd(buffer + s);
+        for (int i = 0; i < sections; i++) {
+            __m128d x = y;
+            y = _mm_add_pd(_mm_mul_pd(b0[i], x), z1[i]);
+            z1[i] = _mm_add_pd(
+                _mm_sub_pd(_mm_mul_pd(b1[i], x), _mm_mul_pd(a1[i], y)),
+                z2[i]);
+            z2[i] = _mm_sub_pd(_mm_mul_pd(b2[i], x), _mm_mul_pd(a2[i], y));
+        }
+        _mm_store_pd(buffer + s, y);
+    }
+    convert_to_short(buffer, samples, n);
+
+    for (int i = 0; i < sections; i++) {
+        _mm_storel_pd(&left.sections[i].z1, z1[i]);
+        _mm_storeh_pd(&right.sections[i].z1, z1[i]);
+        _mm_storel_pd(&left.sections[i].z2, z2[i]);
+        _mm_storeh_pd(&right.sections[i].z2, z2[i]);
+    }
+}
+
+// Mono: the four sections pipelined across the lanes of an AVX2 register.
+template <int Order>
+FREQ_CUTOFF_TARGET("avx2")
+void filter_mono_avx2(const ButterworthCoefficients& coefficients,
+                      ButterworthFilter& filter, short* samples,
+                      int sample_count) {
+    constexpr int sections = Order / 2;
+    static_assert(sections <= pipeline_lanes,
+                  "the mono pipeline needs one lane per section");
+    ButterworthChannelFilter& channel_filter = filter.channel_filters[0];
+
+    alignas(32) double b0[pipeline_lanes] = {1, 1, 1, 1};
+    alignas(32) double b1[pipeline_lanes] = {0};
+    alignas(32) double b2[pipeline_lanes] = {0};
+    alignas(32) double a1[pipeline_lanes] = {0};
+    alignas(32) double a2[pipeline_lanes] = {0};
+    alignas(32) double z1[pipeline_lanes] = {0};
+    alignas(32) double z2[pipeline_lanes] = {0};
+    for (int i = 0; i < sections; i++) {
+        const BiquadCoefficients& section = coefficients.sections[i];
+        b0[i] = section.b0;
+        b1[i] = section.b1;
+        b2[i] = section.b2;
+        a1[i] = section.a1;
+        a2[i] = section.a2;
+        z1[i] = channel_filter.sections[i].z1;
+        z2[i] = channel_filter.sections[i].z2;
+    }
+    const __m256d vb0 = _mm256_load_pd(b0);
+    const __m256d vb1 = _mm256_load_pd(b1);
+    const __m256d vb2 = _mm256_load_pd(b2);
+    const __m256d va1 = _mm256_load_pd(a1);
+    const __m256d va2 = _mm256_load_pd(a2);
+    __m256d vz1 = _mm256_load_pd(z1);
+    __m256d vz2 = _mm256_load_pd(z2);
+    __m256d y = _mm256_setzero_pd();
+
+    alignas(32) double buffer[simd_block];
+    convert_to_double(samples, buffer, sample_count);
+    constexpr int latency = pipeline_lanes - 1;
+    for (int t = 0; t < sample_count + latency; t++) {
+        double input = t < sample_count ? buffer[t] : 0.0;
+        // shift the previous outputs up by one lane and feed the new sample
+        // into the first one
+        __m256d x = _mm256_blend_pd(_mm256_permute4x64_pd(y, 0x90),
+                                    _mm256_set1_pd(input), 0x1);
+        y = _mm256_add_pd(_mm256_mul_pd(vb0, x), vz1);
+        __m256d new_z1 = _mm256_add_pd(
+            _mm256_sub_pd(_mm256_mul_pd(vb1, x), _mm256_mul_pd(va1, y)), vz2);
+        __m256d new_z2 =
+            _mm256_sub_pd(_mm256_mul_pd(vb2, x), _mm256_mul_pd(va2, y));
+        if (t < latency || t >= sample_count) {
+            long long active[pipeline_lanes];
+            for (int i = 0; i < pipeline_lanes; i++) {
+                active[i] = (t - i >= 0 && t - i < sample_count) ? -1 : 0;
+            }
+            __m256d mask = _mm256_castsi256_pd(_mm256_set_epi64x(
+                active[3], active[2], active[1], active[0]));
+            vz1 = _mm256_blendv_pd(vz1, new_z1, mask);
+            vz2 = _mm256_blendv_pd(vz2, new_z2, mask);
+        } else {
+            vz1 = new_z1;
+            vz2 = new_z2;
+        }
+        if (t >= latency) {
+            // the input of this sample was consumed latency steps ago
+            __m128d high = _mm256_extractf128_pd(y, 1);
+            buffer[t - latency] = _mm_cvtsd_f64(_mm_unpackhi_pd(high, high));
+        }
+    }
+    convert_to_short(buffer, samples, sample_count);
+
+    _mm256_store_pd(z1, vz1);
+    _mm256_store_pd(z2, vz2);
+    for (int i = 0; i < sections; i++) {
+        channel_filter.sections[i].z1 = z1[i];
+        channel_filter.sections[i].z2 = z2[i];
+    }
+}
+
+#endif
+
+template <void (*Kernel)(const ButterworthCoefficients&, ButterworthFilter&,
+                         short*, int)>
+void filter_in_blocks(const ButterworthCoefficients& coefficients,
+                      ButterworthFilter& filter, short* samples,
+                      int sample_count, int channels) {
+    for (int s = 0; s < sample_count; s += simd_block) {
+        Kernel(coefficients, filter, samples + s * channels,
+               std::min(simd_block, sample_count - s));
+    }
+}
+
+#endif
+
+// The kernels for every supported order and channel layout, chosen once at
+// startup based on the build and on what the cpu supports. Each client looks
+// up its kernel when its filter is created.
+class KernelTable {
+   public:
+    const char* name = "scalar biquad";
+    // indexed by [order / 2][channels]
+    KernelFunction kernels[max_section_count + 1][max_channels + 1] = {};
+
+    // nullptr for a channel count there is no filter state for
+    KernelFunction get(int order, int channels) const {
+        if (channels < 1 || channels > max_channels) {
+            return nullptr;
+        }
+        return kernels[order / 2][channels];
+    }
+
+    void set(int order, int channels, KernelFunction kernel) {
+        kernels[order / 2][channels] = kernel;
+    }
+};
+
+// the direct form and fixed point builds have no simd kernels to pick from
+template <int Order>
+void fill_kernels(KernelTable& table,
+                  [[maybe_unused]] const CpuFeatures& cpu) {
+#ifdef FREQ_CUTOFF_DIRECT_FORM
+    for (int channels = 1; channels <= max_channels; channels++) {
+        table.set(Order, channels, filter_direct_form<Order>);
+    }
+#elif defined(FREQ_CUTOFF_FIXED)
+    table.set(Order, 1, filter_fixed_cascade<Order, 1>);
+    table.set(Order, 2, filter_fixed_cascade<Order, 2>);
+#else
+    table.set(Order, 1, filter_biquad_cascade<Order, 1>);
+    table.set(Order, 2, filter_biquad_cascade<Order, 2>);
+#if defined(FREQ_CUTOFF_X86) && defined(FREQ_CUTOFF_FLOAT)
+    // the pipelines cost the same regardless of how many lanes carry a
+    // section, so they only pay off for the higher orders
+    if (cpu.sse2 && Order / 2 > pipeline_lanes / 2) {
+        table.set(Order, 1, filter_in_blocks<filter_mono_sse2<Order>>);
+    }
+    if (cpu.avx2 && Order / 2 > pipeline_lanes / 2) {
+        table.set(Order, 2, filter_in_blocks<filter_stereo_avx2<Order>>);
+    }
+#elif defined(FREQ_CUTOFF_X86)
+    if (cpu.sse2) {
+        table.set(Order, 2, filter_in_blocks<filter_stereo_sse2<Order>>);
+    }
+    // the pipeline costs the same regardless of how many lanes carry a
+    // section, so it only pays off for the higher orders
+    if (cpu.avx2 && Order / 2 > pipeline_lanes / 2) {
+        table.set(Order, 1, filter_in_blocks<filter_mono_avx2<Order>>);
+    }
+#endif
+#endif
+}
+
+KernelTable select_kernels() {
+    KernelTable table;
+    CpuFeatures cpu;
+    fill_kernels<2>(table, cpu);
+    fill_kernels<4>(table, cpu);
+    fill_kernels<6>(table, cpu);
+    fill_kernels<8>(table, cpu);
+#ifdef FREQ_CUTOFF_DIRECT_FORM
+    table.name = "direct form";
+#elif defined(FREQ_CUTOFF_FIXED)
+    table.name = "q30 fixed point biquad";
+#elif defined(FREQ_CUTOFF_FLOAT)
+    if (cpu.avx2) {
+        table.name = "avx2/sse2 float biquad";
+    } else if (cpu.sse2) {
+        table.name = "sse2 float biquad";
+    } else {
+        table.name = "scalar float biquad";
+    }
+#else
+    if (cpu.avx2) {
+        table.name = "avx2/sse2 biquad";
+    } else if (cpu.sse2) {
+        table.name = "sse2 biquad";
+    }
+#endif
+    return table;
+}
@@ -1,203 +1,1093 @@
-/*
- * Copyright (c) 2018 Michael Vilim
- *
- * This file is part of the teamspeak frequency cutoff filter plugin. It is
- * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
- *
- * This program is free software: you can redistribute it and/or modify it under
- * the terms of the GNU General Public License as published by the Free Software
- * Foundation, either version 3 of the License, or (at your option) any later
- * version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#pragma once
-
-#include <string>
-#include <fstream>
-#include <map>
-#include <set>
-#include <memory>
-
-#include <teamspeak/public_definitions.h>
-#include <ts3_log.h>
-
-extern "C" {
-#include <iir.h>
-}
-
-using std::atomic;
-using std::endl;
-using std::map;
-using std::set;
-using std::shared_ptr;
-using std::string;
-
-// although it does not appear that a 48k hz sample rate is guaranteed by
-// teamspeak, the main codecs used all have that sample rate
-// -- should read from the CHANNEL_CODEC property
-constexpr double sample_rate = 48000.0;
-// order of the butterworth filter
-constexpr const int buffer_size = 8;
-
-class ButterworthCoefficients {
-   public:
-    int cutoff_freq;
-    double b[buffer_size + 1];
-    double a[buffer_size + 1];
-
-    ButterworthCoefficients(int cutoff_freq) : cutoff_freq(cutoff_freq) {
-        double ff = cutoff_freq / (sample_rate / 2.0);
-        double scale = sf_bwlp(buffer_size, ff);
-        double* new_a = dcof_bwlp(buffer_size, ff);
-        int* new_b = ccof_bwlp(buffer_size);
-        for (int i = 0; i <= buffer_size; i++) {
-            a[i] = new_a[i];
-            b[i] = new_b[i] * scale;
-        }
-        delete[] new_a;
-        delete[] new_b;
-    };
-};
-
-class FilterConf {
-   public:
-    bool enabled;
-    ButterworthCoefficients coefficients;
-
-    FilterConf(bool enabled, int cutoffFreq)
-        : enabled(enabled), coefficients(cutoffFreq){};
-
-    bool operator==(const FilterConf other) const {
-        return enabled == other.enabled &&
-               coefficients.cutoff_freq == other.coefficients.cutoff_freq;
-    }
-};
-
-class ButterworthChannelFilter {
-   public:
-    double x[buffer_size] = {0};
-    double y[buffer_size] = {0};
-    int index = 0;
-
-    void reset() {
-        std::fill(x, x + buffer_size, 0);
-        std::fill(y, y + buffer_size, 0);
-        index = 0;
-    }
-};
-
-class ButterworthFilter {
-   public:
-    int cutoff_freq;
-
-    ButterworthFilter(int cutoff_freq) : cutoff_freq(cutoff_freq){};
-
-    map<int, ButterworthChannelFilter> channel_map;
-
-    void reset() {
-        for (auto& channel : channel_map) {
-            channel.second.reset();
-        }
-    };
-};
-
-class ServerFilterGroup {
-   public:
-    map<anyID, const string> resolvedIds;
-    set<anyID> unresolvableIds;
-    map<anyID, ButterworthFilter> client_id_to_filter;
-};
-
-class ApplicationFilterGroup {
-   private:
-    map<const string, FilterConf> file_confs;
-    shared_ptr<map<const string, FilterConf>> confs;
-    const string config_filename;
-    const TS3Functions& ts3_functions;
-
-   public:
-    ApplicationFilterGroup(const TS3Functions& ts3_functions,
-                           const string config_filename)
-        : ts3_functions(ts3_functions), config_filename(config_filename) {
-        string line;
-        string delimiter = " ";
-
-        std::ifstream config_file(config_filename);
-        if (config_file.good() && config_file.is_open()) {
-            while (std::getline(config_file, line)) {
-                if (!line.empty()) {
-                    size_t first_delim = line.find(delimiter, 0);
-                    size_t second_delim = line.find(delimiter, first_delim + 1);
-                    std::string name = line.substr(0, first_delim);
-                    std::string str_freq =
-                        line.substr(first_delim + 1, second_delim);
-                    std::string st_enabled =
-                        line.substr(second_delim + 1, second_delim + 2);
-                    int freq = std::stoi(str_freq);
-                    bool enabled = std::stoi(st_enabled);
-                    log_info(ts3_functions,
-                             "Loaded cutoff filter for %s %i Hz, enabled = %s",
-                             name.c_str(), freq, enabled ? "true" : "false");
-                    file_confs.emplace(name, FilterConf(enabled, freq));
-                }
-            }
-            config_file.close();
-        }
-
-        store_atomic(file_confs);
-    };
-
-    typedef map<const string, FilterConf> ConfMap;
-
-    map<uint64, ServerFilterGroup> server_filter_groups;
-
-    shared_ptr<ConfMap> load_atomic() {
-        return std::atomic_load<ConfMap>(&confs);
-    }
-
-    void store_atomic(ConfMap new_confs) {
-        std::atomic_store<ConfMap>(&confs,
-                                   std::make_shared<ConfMap>(new_confs));
-    }
-
-    void log_persist_error(const char* details = "") {
-        log_error(ts3_functions,
-                  "Error while trying to save config file. Settings "
-                  "will not be persisted. %s",
-                  details);
-    }
-
-    void persist() {
-        if (file_confs != *confs) {
-            try {
-                std::ofstream config_file(config_filename);
-                if (config_file.good() && config_file.is_open()) {
-                    for (auto const& line : *load_atomic()) {
-                        printf("writing name %s\n", line.first.c_str());
-                        config_file << line.first << " "
-                                    << line.second.coefficients.cutoff_freq
-                                    << " " << line.second.enabled << std::endl;
-                    }
-                    config_file.close();
-                    file_confs = *confs;
-                } else {
-                    log_persist_error();
-                }
-            } catch (const std::runtime_error& re) {
-                log_persist_error(re.what());
-            } catch (const std::exception& ex) {
-                log_persist_error(ex.what());
-            } catch (...) {
-                log_persist_error();
-            }
-        }
-    }
-};
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <fstream>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include <atomic_file.h>
+#include <background_worker.h>
+#include <binary_config.h>
+#include <coefficient_table.h>
+#include <config_parser.h>
+#include <filter_design.h>
+#include <persistent_map.h>
+#include <snapshot_publisher.h>
+#include <teamspeak/public_definitions.h>
+#include <ts3_log.h>
+#include <uid_table.h>
+
+using std::atomic;
+using std::endl;
+using std::map;
+using std::set;
+using std::shared_ptr;
+using std::string;
+
+// although it does not appear that a 48k hz sample rate is guaranteed by
+// teamspeak, the main codecs used all have that sample rate
+// -- should read from the CHANNEL_CODEC property
+constexpr double sample_rate = 48000.0;
+// users without an explicit order get the original, steepest rolloff
+constexpr const int default_order = max_order;
+
+// Precision of the biquad cascade. Filter design always happens in double; a
+// float build only rounds the finished sections, which the cascade form
+// tolerates (the direct form polynomial does not). Single precision halves the
+// filter state and doubles the simd width.
+#ifdef FREQ_CUTOFF_FLOAT
+typedef float filter_real;
+#else
+typedef double filter_real;
+#endif
+
+#ifdef FREQ_CUTOFF_FIXED
+// Fixed point build: the sections run on integers end to end. Coefficients
+// are Q2.30 (the Q31 layout with one more integer bit, since |a1| approaches
+// 2 at low cutoffs). Signals between sections carry fixed_signal_shift
+// fractional bits below the 16 bit sample, which leaves two bits of headroom
+// in an int32 for the overshoot of the intermediate sections.
+constexpr int fixed_coefficient_shift = 30;
+constexpr int fixed_signal_shift = 14;
+
+class FixedBiquadCoefficients {
+   public:
+    int32_t b0 = 0;
+    int32_t b1 = 0;
+    int32_t b2 = 0;
+    int32_t a1 = 0;
+    int32_t a2 = 0;
+};
+
+int32_t to_fixed_coefficient(double value) {
+    return (int32_t)std::lround(value * (1 << fixed_coefficient_shift));
+}
+#endif
+
+// a single second order section, normalized so that a0 = 1
+class BiquadCoefficients {
+   public:
+    filter_real b0 = 0;
+    filter_real b1 = 0;
+    filter_real b2 = 0;
+    filter_real a1 = 0;
+    filter_real a2 = 0;
+};
+
+class ButterworthCoefficients {
+   public:
+    FilterType type;
+    int cutoff_freq;
+    int order;
+    double design_rate;
+    // direct form polynomial coefficients -- only used by the direct form
+    // kernel, which loses stability at low cutoffs
+    double b[max_order + 1] = {0};
+    double a[max_order + 1] = {0};
+    BiquadCoefficients sections[max_section_count];
+#ifdef FREQ_CUTOFF_FIXED
+    FixedBiquadCoefficients fixed_sections[max_section_count];
+#endif
+    // Share of each section's input that is mixed into its output in place of
+    // the section's own output. Only the retargeting kernels use it, to fade
+    // out the sections a lower order drops (see below); a designed filter
+    // leaves it at 0.
+    filter_real dry[max_section_count] = {0};
+#ifdef FREQ_CUTOFF_FIXED
+    int32_t fixed_dry[max_section_count] = {0};
+#endif
+
+    ButterworthCoefficients(int cutoff_freq, int order = default_order,
+                            FilterType type = FilterType::LOW_PASS,
+                            double design_rate = sample_rate)
+        : type(type),
+          cutoff_freq(cutoff_freq),
+          order(order),
+          design_rate(design_rate) {
+        // dialog cutoffs come from the precomputed table. If the design fails
+        // (e.g. a hand edited cutoff above the nyquist frequency) the sections
+        // stay pass through and audio is left as is
+        SectionDesign designed[max_section_count];
+        if (lookup_butterworth(type, order, cutoff_freq, design_rate,
+                               designed)) {
+            expand_sections(designed, order, b, a);
+        } else if (!design_butterworth(type, order, cutoff_freq, design_rate,
+                                       designed, b, a)) {
+            b[0] = 1.0;
+            a[0] = 1.0;
+        }
+
+        for (int i = 0; i < section_count(); i++) {
+            set_section(i, designed[i]);
+        }
+    };
+
+    // Coefficients part way from one design to another, for retargeting a
+    // running filter: t = 0 gives from and t = 1 gives to. The cutoff is swept
+    // geometrically, so every step is a similar change in pitch, and a
+    // butterworth filter of each order is designed at the swept cutoff. A
+    // change of order then blends the two designs section by section, with the
+    // design that has fewer sections padded with pass through ones. Blending
+    // linearly keeps stable sections stable, because the region of stable
+    // (a1, a2) pairs is a triangle and so convex.
+    //
+    // Sections a lower order drops are not blended to pass through, though:
+    // pulling their poles off the unit circle within a frame turns the state
+    // they hold into a click. They keep running at their own (swept) design
+    // and are cross faded to their input instead, so by the end their state
+    // is no longer heard and can be dropped.
+    ButterworthCoefficients(const ButterworthCoefficients& from,
+                            const ButterworthCoefficients& to, double t)
+        : type(to.type),
+          cutoff_freq(to.cutoff_freq),
+          order(std::max(from.order, to.order)),
+          design_rate(to.design_rate) {
+        std::copy(to.b, to.b + max_order + 1, b);
+        std::copy(to.a, to.a + max_order + 1, a);
+        // Sweeping the poles up against z = 1 within a frame makes the state
+        // swell into a thump, so the sweep stays above the lowest dialog step.
+        // A muted end point is instead faded in or out through the numerator.
+        constexpr double sweep_floor = MULTIPLIER;
+        double low = std::max<double>(from.cutoff_freq, sweep_floor);
+        double high = std::max<double>(to.cutoff_freq, sweep_floor);
+        double cutoff = std::pow(low, 1 - t) * std::pow(high, t);
+        // applied to every section, which fades out faster than linearly and
+        // leaves little in the state for the final step to the mute design
+        double gain = 1;
+        if (from.mutes()) {
+            gain *= t;
+        }
+        if (to.mutes()) {
+            gain *= 1 - t;
+        }
+        SectionDesign from_design[max_section_count];
+        SectionDesign to_design[max_section_count];
+        from.design_at(t <= 0 ? from.cutoff_freq : cutoff, from_design);
+        to.design_at(t >= 1 ? to.cutoff_freq : cutoff, to_design);
+        for (int i = 0; i < section_count(); i++) {
+            // a default SectionDesign is pass through
+            SectionDesign f = i < from.section_count() ? from_design[i]
+                                                       : SectionDesign();
+            SectionDesign g = f;
+            if (i < to.section_count()) {
+                g = to_design[i];
+            } else {
+                set_dry(i, t);
+            }
+            SectionDesign blended;
+            blended.b0 = ((1 - t) * f.b0 + t * g.b0) * gain;
+            blended.b1 = ((1 - t) * f.b1 + t * g.b1) * gain;
+            blended.b2 = ((1 - t) * f.b2 + t * g.b2) * gain;
+            blended.a1 = (1 - t) * f.a1 + t * g.a1;
+            blended.a2 = (1 - t) * f.a2 + t * g.a2;
+            set_section(i, blended);
+        }
+    }
+
+    // a 0 Hz low pass lets nothing through
+    bool mutes() const {
+        return type == FilterType::LOW_PASS && cutoff_freq == 0;
+    }
+
+    int section_count() const { return order / 2; }
+
+   private:
+    void set_dry(int i, double share) {
+        dry[i] = (filter_real)share;
+#ifdef FREQ_CUTOFF_FIXED
+        fixed_dry[i] = to_fixed_coefficient(share);
+#endif
+    }
+
+    void set_section(int i, const SectionDesign& designed) {
+        BiquadCoefficients& section = sections[i];
+        section.b0 = (filter_real)designed.b0;
+        section.b1 = (filter_real)designed.b1;
+        section.b2 = (filter_real)designed.b2;
+        section.a1 = (filter_real)designed.a1;
+        section.a2 = (filter_real)designed.a2;
+#ifdef FREQ_CUTOFF_FIXED
+        FixedBiquadCoefficients& fixed = fixed_sections[i];
+        fixed.b0 = to_fixed_coefficient(designed.b0);
+        fixed.b1 = to_fixed_coefficient(designed.b1);
+        fixed.b2 = to_fixed_coefficient(designed.b2);
+        fixed.a1 = to_fixed_coefficient(designed.a1);
+        fixed.a2 = to_fixed_coefficient(designed.a2);
+#endif
+    }
+
+    // this design's type and order at another cutoff -- if that cannot be
+    // designed, this design's own sections
+    void design_at(double cutoff, SectionDesign* designed) const {
+        if (design_butterworth(type, order, cutoff, design_rate, designed)) {
+            return;
+        }
+        for (int i = 0; i < section_count(); i++) {
+            designed[i].b0 = sections[i].b0;
+            designed[i].b1 = sections[i].b1;
+            designed[i].b2 = sections[i].b2;
+            designed[i].a1 = sections[i].a1;
+            designed[i].a2 = sections[i].a2;
+        }
+    }
+};
+
+typedef shared_ptr<const ButterworthCoefficients> CoefficientsHandle;
+
+// Process wide cache of designed filters. The dialog only offers a few
+// hundred distinct (cutoff, order) pairs, so most users share a design: the
+// cache hands out the same immutable coefficients for equal parameters, which
+// makes copying a config map a matter of copying pointers and keeps memory
+// proportional to the distinct designs rather than to the users. Entries are
+// never evicted (even a hand edited config only adds a handful).
+class CoefficientCache {
+   private:
+    typedef std::tuple<FilterType, int, int, double> Key;
+    std::mutex mutex;
+    map<Key, CoefficientsHandle> designs;
+
+   public:
+    CoefficientsHandle get(int cutoff_freq, int order = default_order,
+                           FilterType type = FilterType::LOW_PASS,
+                           double design_rate = sample_rate) {
+        Key key(type, order, cutoff_freq, design_rate);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = designs.find(key);
+        if (found != designs.end()) {
+            return found->second;
+        }
+        CoefficientsHandle coefficients =
+            std::make_shared<const ButterworthCoefficients>(
+                cutoff_freq, order, type, design_rate);
+        designs.emplace(key, coefficients);
+        return coefficients;
+    }
+};
+
+CoefficientCache coefficient_cache;
+
+class FilterConf {
+   public:
+    bool enabled;
+    CoefficientsHandle coefficients;
+
+    FilterConf(bool enabled, int cutoffFreq, int order = default_order)
+        : enabled(enabled),
+          coefficients(coefficient_cache.get(cutoffFreq, order)){};
+
+    bool operator==(const FilterConf other) const {
+        return enabled == other.enabled &&
+               coefficients->cutoff_freq == other.coefficients->cutoff_freq &&
+               coefficients->order == other.coefficients->order;
+    }
+};
+
+// transposed direct form II state of a single second order section
+class BiquadState {
+   public:
+    filter_real z1 = 0;
+    filter_real z2 = 0;
+};
+
+#ifdef FREQ_CUTOFF_FIXED
+// Direct form I state of a single fixed point section. error holds the bits
+// dropped when the previous output was truncated, which are fed back into the
+// next accumulation (first order noise shaping). Without it the truncation
+// noise is amplified by the high gain of the poles near DC at low cutoffs.
+class FixedBiquadState {
+   public:
+    int32_t x1 = 0;
+    int32_t x2 = 0;
+    int32_t y1 = 0;
+    int32_t y2 = 0;
+    int64_t error = 0;
+};
+#endif
+
+// channels of filter state kept per client -- the playback callback delivers
+// mono or stereo voice, anything wider is passed through unfiltered
+constexpr const int max_channels = 2;
+
+// Filter state of one channel. The cascade state is kept in the format of the
+// build's kernels only (integer in the fixed point build), plus the history of
+// the direct form kernel when that is built. Each channel starts on its own
+// cache line, which the double precision state of an order 8 cascade fills
+// exactly.
+class alignas(64) ButterworthChannelFilter {
+   public:
+#ifdef FREQ_CUTOFF_DIRECT_FORM
+    // Direct form history. Every value is written twice, at index and at
+    // index + order, so the last order values always sit contiguously just
+    // below index + order and the kernel never has to wrap its reads around
+    // the end of the buffer.
+    double x[2 * max_order] = {0};
+    double y[2 * max_order] = {0};
+    int index = 0;
+#endif
+#ifdef FREQ_CUTOFF_FIXED
+    FixedBiquadState fixed_sections[max_section_count];
+#else
+    BiquadState sections[max_section_count];
+#endif
+
+    void reset() { *this = ButterworthChannelFilter(); }
+};
+
+// Signature shared by all filter kernels. The samples are interleaved and
+// filtered in place.
+class ButterworthFilter;
+typedef void (*KernelFunction)(const ButterworthCoefficients& coefficients,
+                               ButterworthFilter& filter, short* samples,
+                               int sample_count, int channels);
+
+class ButterworthFilter {
+   public:
+    CoefficientsHandle coefficients;
+    // the design this filter is being moved away from, set for the first
+    // frame after a change of cutoff or order
+    CoefficientsHandle fade_from;
+    // kernel specialized for this client's order and channel count, picked
+    // when the filter is created or the order or channel count changes
+    KernelFunction kernel = nullptr;
+    int kernel_channels = 0;
+
+    ButterworthFilter(CoefficientsHandle coefficients)
+        : coefficients(coefficients){};
+
+    // indexed by channel, inline so that the state of a mono or stereo
+    // client is contiguous with the rest of the filter
+    ButterworthChannelFilter channel_filters[max_channels];
+
+    void reset() {
+        for (ButterworthChannelFilter& channel : channel_filters) {
+            channel.reset();
+        }
+    };
+
+    // Moves the filter to a new design without dropping its history, so a
+    // cutoff change does not click. The kernel then interpolates between the
+    // designs over the next frame (see run_filter).
+    void retarget(CoefficientsHandle target) {
+#ifdef FREQ_CUTOFF_DIRECT_FORM
+        // the direct form polynomial cannot be interpolated safely, so it
+        // starts over as before
+        reset();
+#else
+        // sections the old design did not run may hold stale state from an
+        // earlier, higher order -- they start from rest as pass through
+        int used = coefficients->section_count();
+        for (ButterworthChannelFilter& channel : channel_filters) {
+#ifdef FREQ_CUTOFF_FIXED
+            std::fill(channel.fixed_sections + used,
+                      channel.fixed_sections + max_section_count,
+                      FixedBiquadState());
+#else
+            std::fill(channel.sections + used,
+                      channel.sections + max_section_count, BiquadState());
+#endif
+        }
+        fade_from = coefficients;
+#endif
+        coefficients = target;
+        kernel = nullptr;
+    }
+};
+
+// Edits share every untouched entry with the previous version, so publishing
+// a change to one user costs O(log n) rather than a copy of every user's conf.
+typedef PersistentMap<string, FilterConf> ConfMap;
+typedef SnapshotPublisher<ConfMap>::Snapshot ConfSnapshot;
+
+// records in each server's filter pool unless the plugin asks for another
+// capacity
+constexpr const size_t default_filter_capacity = 64;
+// how long a filter has to go without audio before its record can be taken
+// for another speaker
+constexpr std::chrono::milliseconds filter_idle_time{1000};
+
+// The filters of all clients, preallocated up front so that a new speaker
+// never allocates on the audio thread. Records in use are kept in least
+// recently used order. When every record is in use, the least recently used
+// one is taken from its client if that client has been idle for
+// filter_idle_time -- its state has decayed by then, so the client simply
+// starts from rest when it speaks again. Acquire, touch and release are O(1).
+//
+// A record does not point back at its client: the client keeps the record's
+// generation and checks it before use (see ClientSlot::own_filter), so a
+// record can be taken away, and a client freed, without the other knowing.
+//
+// Only used from the audio callback of its server.
+class FilterPool {
+   public:
+    class Record {
+       public:
+        std::optional<ButterworthFilter> filter;
+        // moved on each time the record is handed out
+        uint64_t generation = 0;
+        std::chrono::steady_clock::time_point last_used;
+        // towards the most (prev) and least (next) recently used record, or
+        // the next free record
+        Record* prev = nullptr;
+        Record* next = nullptr;
+    };
+
+   private:
+    std::unique_ptr<Record[]> records;
+    Record* free_records = nullptr;
+    Record* most_recent = nullptr;
+    Record* least_recent = nullptr;
+
+    void unlink(Record* record) {
+        (record->prev ? record->prev->next : most_recent) = record->next;
+        (record->next ? record->next->prev : least_recent) = record->prev;
+        record->prev = nullptr;
+        record->next = nullptr;
+    }
+
+    void push_most_recent(Record* record) {
+        record->next = most_recent;
+        (most_recent ? most_recent->prev : least_recent) = record;
+        most_recent = record;
+    }
+
+   public:
+    const size_t capacity;
+    // set from the first failed acquire until the next successful one, so
+    // that running out is only reported once
+    bool exhausted = false;
+
+    FilterPool(size_t capacity)
+        : records(new Record[capacity]), capacity(capacity) {
+        for (size_t i = capacity; i-- > 0;) {
+            records[i].next = free_records;
+            free_records = &records[i];
+        }
+    }
+
+    FilterPool(const FilterPool&) = delete;
+    FilterPool& operator=(const FilterPool&) = delete;
+
+    // a record with a new filter, or nullptr if none is free or idle
+    Record* acquire(CoefficientsHandle coefficients,
+                    std::chrono::steady_clock::time_point now) {
+        Record* record = free_records;
+        if (record != nullptr) {
+            free_records = record->next;
+            record->next = nullptr;
+        } else if (least_recent != nullptr &&
+                   now - least_recent->last_used >= filter_idle_time) {
+            record = least_recent;
+            unlink(record);
+        } else {
+            return nullptr;
+        }
+        record->filter.emplace(coefficients);
+        record->generation++;
+        record->last_used = now;
+        push_most_recent(record);
+        return record;
+    }
+
+    // marks the record as used now
+    void touch(Record* record, std::chrono::steady_clock::time_point now) {
+        record->last_used = now;
+        if (record != most_recent) {
+            unlink(record);
+            push_most_recent(record);
+        }
+    }
+
+    void release(Record* record) {
+        unlink(record);
+        record->filter.reset();
+        record->generation++;
+        record->next = free_records;
+        free_records = record;
+    }
+};
+
+// Everything the audio callback needs for one client of one server.
+class ClientSlot {
+   public:
+    // Serial of the uid the slot's state belongs to (see InternedUid), 0
+    // while the client is unresolved. The uid itself may be freed once its
+    // client is gone, so the slot does not keep a pointer to it.
+    uint64_t uid_serial = 0;
+    // Generation of the conf snapshot the uid was last looked up in, and the
+    // conf found there (nullptr if the uid has none). The pointer is only
+    // used while that snapshot is still the current one, and the string
+    // lookup only reruns when the confs change.
+    uint64_t conf_generation = 0;
+    const FilterConf* conf = nullptr;
+    // the client's filter record and the record's generation when it was
+    // handed to this client
+    FilterPool::Record* filter = nullptr;
+    uint64_t filter_generation = 0;
+    // Conf generation at which this client was found to have no enabled
+    // filter (or no uid). Until the confs or its uid change its audio is
+    // passed through without looking at anything else. 0 is never a
+    // generation.
+    uint64_t unfiltered_generation = 0;
+
+    // Hands the slot to another uid: the client was resolved, or the client
+    // id was given to someone else. Nothing of the previous user's is kept.
+    void set_uid(uint64_t new_uid_serial, FilterPool& pool) {
+        uid_serial = new_uid_serial;
+        conf_generation = 0;
+        conf = nullptr;
+        release_filter(pool);
+        unfiltered_generation = 0;
+    }
+
+    // the client's filter, nullptr if it has none or the pool took it back
+    ButterworthFilter* own_filter() {
+        if (filter == nullptr || filter->generation != filter_generation) {
+            return nullptr;
+        }
+        return &*filter->filter;
+    }
+
+    void set_filter(FilterPool::Record* record) {
+        filter = record;
+        filter_generation = record->generation;
+    }
+
+    void release_filter(FilterPool& pool) {
+        if (own_filter() != nullptr) {
+            pool.release(filter);
+        }
+        filter = nullptr;
+    }
+
+    // the conf of uid, which has to be the slot's
+    const FilterConf* lookup_conf(const ConfSnapshot& current,
+                                  const InternedUid& uid) {
+        if (conf_generation != current.generation) {
+            conf_generation = current.generation;
+            conf = current.value.find(uid.value);
+        }
+        return conf;
+    }
+};
+
+// Client slots indexed directly by client id. anyID is 16 bits, so a flat
+// table would always hold 64k slots; instead the ids are split into pages of
+// client_page_size slots. A page is added (by the client events) when the
+// first client in its range is resolved and dropped once none of its clients
+// is left (the pages match the uid table's, which tracks that). Client ids are
+// handed out from 1 upwards, so a server normally needs a single page.
+constexpr int client_page_bits = UidTable::page_bits;
+constexpr int client_page_size = 1 << client_page_bits;
+constexpr int client_page_count =
+    (std::numeric_limits<anyID>::max() >> client_page_bits) + 1;
+
+// What the audio callback of one server writes besides the slots: the
+// server's filters. Each server is a shard of its own, so callbacks for
+// different servers can run in parallel without sharing any written state.
+class ServerAudioState {
+   public:
+    FilterPool filter_pool;
+    // set while a callback for the server is running
+    std::atomic_flag busy = ATOMIC_FLAG_INIT;
+
+    ServerAudioState(size_t filter_capacity) : filter_pool(filter_capacity){};
+
+    // Makes the calling callback the only writer of the server's state for
+    // as long as it lives. The callbacks of one server are not expected to
+    // overlap, but if they do, the second one gets no ownership (and passes
+    // its audio through) rather than waiting or sharing the state.
+    class Claim {
+       private:
+        ServerAudioState& state;
+
+       public:
+        const bool owned;
+
+        Claim(ServerAudioState& state)
+            : state(state),
+              owned(!state.busy.test_and_set(std::memory_order_acquire)){};
+
+        Claim(const Claim&) = delete;
+        Claim& operator=(const Claim&) = delete;
+
+        ~Claim() {
+            if (owned) {
+                state.busy.clear(std::memory_order_release);
+            }
+        }
+    };
+};
+
+// One version of a server's pages. A change of pages publishes a new version
+// (see ApplicationFilterGroup::servers); the pages themselves, the slots in
+// them and the audio state are shared between versions and only written by
+// the server's audio callback.
+class ServerFilterGroup {
+   public:
+    std::shared_ptr<ServerAudioState> audio;
+    std::shared_ptr<ClientSlot[]> pages[client_page_count];
+
+    ServerFilterGroup(size_t filter_capacity)
+        : audio(std::make_shared<ServerAudioState>(filter_capacity)){};
+
+    // nullptr if no client in the id's range is known
+    ClientSlot* client(anyID client_id) const {
+        ClientSlot* page = pages[client_id >> client_page_bits].get();
+        if (page == nullptr) {
+            return nullptr;
+        }
+        return &page[client_id & (client_page_size - 1)];
+    }
+};
+
+typedef PersistentMap<uint64, std::shared_ptr<const ServerFilterGroup>>
+    ServerMap;
+typedef SnapshotPublisher<ServerMap>::Snapshot ServerSnapshot;
+
+// how long a client that left keeps its state, for audio that is still
+// playing after the event
+constexpr std::chrono::milliseconds client_retire_grace{5000};
+// how long the config write waits for further changes to go with it
+constexpr std::chrono::milliseconds persist_delay{500};
+
+// the conf of a config line (text or binary) -- the order was added later and
+// is optional
+FilterConf line_conf(const ConfigLine& line) {
+    int order = valid_order(line.order) ? line.order : default_order;
+    return FilterConf(line.enabled, line.cutoff_freq, order);
+}
+
+// the binary config that takes the place of a text config when present
+string binary_config_name(const string& config_filename) {
+    const string suffix = ".conf";
+    if (config_filename.size() >= suffix.size() &&
+        config_filename.compare(config_filename.size() - suffix.size(),
+                                suffix.size(), suffix) == 0) {
+        return config_filename.substr(
+                   0, config_filename.size() - suffix.size()) +
+               ".bin";
+    }
+    return config_filename + ".bin";
+}
+
+// The binary config after the confs changed from written to current: the
+// entries of the old file whose uid was never loaded are kept as they are.
+std::string merge_binary_config(const BinaryConfig& old_config,
+                                const ConfMap& written,
+                                const ConfMap& current) {
+    std::vector<ConfigLine> changed;
+    current.for_each([&](const string& name, const FilterConf& conf) {
+        ConfigLine line;
+        line.name = name;
+        line.cutoff_freq = conf.coefficients->cutoff_freq;
+        line.enabled = conf.enabled;
+        line.order = conf.coefficients->order;
+        changed.push_back(line);
+    });
+
+    std::vector<ConfigLine> merged;
+    merged.reserve(old_config.size() + changed.size());
+    size_t next_changed = 0;
+    for (size_t i = 0; i < old_config.size(); i++) {
+        ConfigLine line = old_config.entry(i);
+        while (next_changed < changed.size() &&
+               changed[next_changed].name < line.name) {
+            merged.push_back(changed[next_changed++]);
+        }
+        if (next_changed < changed.size() &&
+            changed[next_changed].name == line.name) {
+            merged.push_back(changed[next_changed++]);
+        } else if (!written.contains(string(line.name))) {
+            // removed if it was loaded and is no longer in the confs
+            merged.push_back(line);
+        }
+    }
+    merged.insert(merged.end(), changed.begin() + next_changed, changed.end());
+    return encode_binary_config(merged);
+}
+
+class ApplicationFilterGroup {
+   private:
+    // What the config file holds (as far as we know). With a binary config
+    // that is only the entries loaded so far (see load_binary_conf), and the
+    // config holds the rest as they are.
+    ConfMap file_confs;
+    std::shared_ptr<const BinaryConfig> binary_config;
+    // guards file_confs, binary_config and the edits of the confs
+    std::mutex conf_lock;
+    // one write at a time
+    std::mutex write_lock;
+    // set while a write is waiting on the worker
+    std::atomic<bool> write_scheduled{false};
+    BackgroundWorker* const worker;
+    SnapshotPublisher<ConfMap> confs{ConfMap()};
+    // The servers and their pages of client slots. Only the client events
+    // change them, by publishing a new version under server_lock; the audio
+    // callback reads them lock free, and what a new version drops is freed
+    // once the audio callback has moved past it.
+    SnapshotPublisher<ServerMap> servers{ServerMap()};
+    std::mutex server_lock;
+    // clients that left, until their grace period is over
+    class RetiringClient {
+       public:
+        uint64 server_id;
+        anyID client_id;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    std::vector<RetiringClient> retiring;
+    const size_t filter_capacity;
+    const string config_filename;
+    const string binary_config_filename;
+    const TS3Functions& ts3_functions;
+
+    // Frees the uids no client holds any more once the audio callbacks that
+    // may have found them are over (they read the uids under the servers'
+    // read guard). Called under server_lock.
+    void retire_uids() {
+        auto released = uids.take_released();
+        if (!released.empty()) {
+            servers.retire(
+                std::make_shared<decltype(released)>(std::move(released)));
+        }
+    }
+
+   public:
+    // Without a worker, persist writes the config synchronously. If there is
+    // a binary config, it is used instead of the text config, and its entries
+    // are only loaded as their clients are seen.
+    ApplicationFilterGroup(const TS3Functions& ts3_functions,
+                           const string config_filename,
+                           size_t filter_capacity = default_filter_capacity,
+                           BackgroundWorker* worker = nullptr)
+        : worker(worker),
+          filter_capacity(filter_capacity),
+          config_filename(config_filename),
+          binary_config_filename(binary_config_name(config_filename)),
+          ts3_functions(ts3_functions) {
+        string text;
+        if (std::ifstream(binary_config_filename).is_open()) {
+            try {
+                binary_config = std::make_shared<const BinaryConfig>(
+                    binary_config_filename);
+                log_info(ts3_functions,
+                         "Using %i cutoff filters from %s (loaded as their "
+                         "clients are seen)",
+                         (int)binary_config->size(),
+                         binary_config_filename.c_str());
+            } catch (const std::exception& e) {
+                // the text config is the best there is, even if it is older
+                log_error(ts3_functions,
+                          "Could not load the binary config (%s), using %s "
+                          "instead. Delete %s to stop using it.",
+                          e.what(), config_filename.c_str(),
+                          binary_config_filename.c_str());
+            }
+        }
+        if (binary_config == nullptr &&
+            read_config_file(config_filename, text)) {
+            ConfigParseStats stats;
+            std::vector<ConfigLine> lines = load_config_lines(text, stats);
+            std::vector<std::pair<string, FilterConf>> entries;
+            entries.reserve(lines.size());
+            for (const ConfigLine& line : lines) {
+                entries.emplace_back(string(line.name), line_conf(line));
+            }
+            file_confs = ConfMap::from_sorted(entries.begin(), entries.end());
+
+            if (stats.malformed == 0) {
+                log_info(ts3_functions, "Loaded %i cutoff filters from %s",
+                         (int)file_confs.size(), config_filename.c_str());
+            } else {
+                log_error(ts3_functions,
+                          "Loaded %i cutoff filters from %s, skipped %i "
+                          "malformed lines (the first is line %i)",
+                          (int)file_confs.size(), config_filename.c_str(),
+                          (int)stats.malformed,
+                          (int)stats.first_malformed_line);
+            }
+        }
+
+        store_atomic(file_confs);
+    };
+
+    // written from the client events, read by the audio callback
+    UidTable uids;
+
+    // the current servers for the audio callback -- valid while the guard
+    // lives, as are the uids found in the meantime
+    SnapshotPublisher<ServerMap>::ReadGuard read_servers() {
+        return servers.read();
+    }
+
+    // the server's current version, nullptr if it has no resolved clients
+    // (or is gone) -- for the audio callback
+    const ServerFilterGroup* audio_server(const ServerSnapshot& current,
+                                          uint64 server_id) {
+        auto found = current.value.find(server_id);
+        return found == nullptr ? nullptr : found->get();
+    }
+
+    // Publishes a client's uid and makes sure it has a slot. Returns false if
+    // there is no room for another server.
+    bool add_client(uint64 server_id, anyID client_id, const string& uid) {
+        // before the uid is published, so its first audio finds the conf
+        load_binary_conf(uid);
+        std::lock_guard<std::mutex> lock(server_lock);
+        if (!uids.publish(server_id, client_id, uid)) {
+            return false;
+        }
+        // a client id is only handed out again once its client has left
+        retiring.erase(
+            std::remove_if(retiring.begin(), retiring.end(),
+                           [&](const RetiringClient& retired) {
+                               return retired.server_id == server_id &&
+                                      retired.client_id == client_id;
+                           }),
+            retiring.end());
+
+        ServerMap current = servers.copy();
+        auto found = current.find(server_id);
+        int page = client_id >> client_page_bits;
+        if (found == nullptr || !(*found)->pages[page]) {
+            auto group =
+                found == nullptr
+                    ? std::make_shared<ServerFilterGroup>(filter_capacity)
+                    : std::make_shared<ServerFilterGroup>(**found);
+            group->pages[page].reset(new ClientSlot[client_page_size]);
+            servers.publish(current.set(server_id, std::move(group)));
+        }
+        // the client id may have had another uid
+        retire_uids();
+        return true;
+    }
+
+    // The client left: its uid and slot are dropped once the grace period is
+    // over (see sweep), unless it comes back first.
+    void retire_client(uint64 server_id, anyID client_id) {
+        std::lock_guard<std::mutex> lock(server_lock);
+        retiring.push_back({server_id, client_id,
+                            std::chrono::steady_clock::now() +
+                                client_retire_grace});
+    }
+
+    // The server is gone: nothing is filtered for it from now on and its
+    // state is freed once the audio callback has moved on.
+    void retire_server(uint64 server_id) {
+        std::lock_guard<std::mutex> lock(server_lock);
+        uids.clear_server(server_id);
+        retiring.erase(std::remove_if(retiring.begin(), retiring.end(),
+                                      [&](const RetiringClient& retired) {
+                                          return retired.server_id ==
+                                                 server_id;
+                                      }),
+                       retiring.end());
+        ServerMap current = servers.copy();
+        if (current.contains(server_id)) {
+            servers.publish(current.erase(server_id));
+        }
+        retire_uids();
+    }
+
+    // Drops the clients whose grace period is over, along with any page of
+    // slots left without a client, and frees what the audio callback no
+    // longer uses. Called from the client events.
+    void sweep() {
+        std::lock_guard<std::mutex> lock(server_lock);
+        auto now = std::chrono::steady_clock::now();
+        ServerMap current = servers.copy();
+        bool changed = false;
+        auto due = std::remove_if(
+            retiring.begin(), retiring.end(),
+            [&](const RetiringClient& retired) {
+                if (retired.deadline > now) {
+                    return false;
+                }
+                uids.clear(retired.server_id, retired.client_id);
+                auto found = current.find(retired.server_id);
+                int page = retired.client_id >> client_page_bits;
+                if (found != nullptr && (*found)->pages[page] &&
+                    !uids.page_in_use(retired.server_id, retired.client_id)) {
+                    auto group = std::make_shared<ServerFilterGroup>(**found);
+                    group->pages[page].reset();
+                    current = current.set(retired.server_id, std::move(group));
+                    changed = true;
+                }
+                return true;
+            });
+        retiring.erase(due, retiring.end());
+        if (changed) {
+            servers.publish(std::move(current));
+        } else {
+            servers.reclaim();
+        }
+        retire_uids();
+    }
+
+    // Generation of the current confs, for checking whether anything changed
+    // without reading them. Each store moves it on.
+    uint64_t conf_generation() { return confs.current_generation(); }
+
+    // the current confs for the audio callback (lock free, no reference
+    // counting) -- valid while the guard lives
+    SnapshotPublisher<ConfMap>::ReadGuard read_confs() { return confs.read(); }
+
+    // a copy of the current confs, for the GUI
+    ConfMap load_confs() { return confs.copy(); }
+
+    void store_atomic(ConfMap new_confs) {
+        confs.publish(std::move(new_confs));
+    }
+
+    // Sets (or with nullptr, removes) the conf of one uid and leaves the rest
+    // as they are, whatever else changed them since -- for the GUI.
+    void update_conf(const string& uid, const FilterConf* conf) {
+        std::lock_guard<std::mutex> lock(conf_lock);
+        ConfMap current = load_confs();
+        store_atomic(conf == nullptr ? current.erase(uid)
+                                     : current.set(uid, *conf));
+    }
+
+    // Copies a uid's entry from the binary config into the confs the first
+    // time the uid is seen. A binary search over the mapped file, which
+    // touches a handful of its pages -- from the client events, never the
+    // audio callback.
+    void load_binary_conf(const string& uid) {
+        std::lock_guard<std::mutex> lock(conf_lock);
+        ConfigLine line;
+        if (!binary_config || file_confs.contains(uid) ||
+            !binary_config->find(uid, line) || line.cutoff_freq < 0) {
+            return;
+        }
+        FilterConf conf = line_conf(line);
+        file_confs = file_confs.set(uid, conf);
+        ConfMap current = load_confs();
+        // an edit made before the uid was seen stays
+        if (!current.contains(uid)) {
+            store_atomic(current.set(uid, conf));
+        }
+    }
+
+    void log_persist_error(const char* details = "") {
+        log_error(ts3_functions,
+                  "Error while trying to save config file. Settings "
+                  "will not be persisted. %s",
+                  details);
+    }
+
+    // Writes the confs to the config file if they differ from what it
+    // holds. Runs on the worker (or the caller's thread when there is none).
+    void write_config() {
+        std::lock_guard<std::mutex> write(write_lock);
+        ConfMap current_confs;
+        ConfMap written_confs;
+        std::shared_ptr<const BinaryConfig> old_config;
+        {
+            std::lock_guard<std::mutex> lock(conf_lock);
+            // snapshots the audio thread was still reading at the last store
+            confs.reclaim();
+            current_confs = load_confs();
+            written_confs = file_confs;
+            old_config = binary_config;
+        }
+        if (written_confs == current_confs) {
+            return;
+        }
+        try {
+            if (old_config) {
+                write_file_synced(binary_config_filename,
+                                  merge_binary_config(*old_config,
+                                                      written_confs,
+                                                      current_confs));
+                old_config.reset();
+                // The file cannot be replaced while it is mapped (on
+                // Windows), so the lookups wait for the rename and the new
+                // mapping.
+                std::lock_guard<std::mutex> lock(conf_lock);
+                binary_config.reset();
+                try {
+                    replace_file(binary_config_filename);
+                } catch (...) {
+                    binary_config = std::make_shared<const BinaryConfig>(
+                        binary_config_filename);
+                    throw;
+                }
+                binary_config = std::make_shared<const BinaryConfig>(
+                    binary_config_filename);
+                file_confs = current_confs;
+            } else {
+                std::ostringstream contents;
+                current_confs.for_each(
+                    [&](const string& name, const FilterConf& conf) {
+                        contents << name << " "
+                                 << conf.coefficients->cutoff_freq << " "
+                                 << conf.enabled << " "
+                                 << conf.coefficients->order << std::endl;
+                    });
+                write_file_atomic(config_filename, contents.str());
+                std::lock_guard<std::mutex> lock(conf_lock);
+                file_confs = current_confs;
+            }
+        } catch (const std::runtime_error& re) {
+            log_persist_error(re.what());
+        } catch (const std::exception& ex) {
+            log_persist_error(ex.what());
+        } catch (...) {
+            log_persist_error();
+        }
+    }
+
+    // Saves the current confs. With a worker, the write happens there after
+    // persist_delay, and further calls until then are covered by it; if the
+    // worker is stopped before, it writes right away.
+    void persist() {
+        if (worker == nullptr) {
+            write_config();
+            return;
+        }
+        if (write_scheduled.exchange(true)) {
+            return;
+        }
+        ApplicationFilterGroup* group = this;
+        bool posted = worker->post_after(persist_delay, [group] {
+            // changes from here on need a write of their own
+            group->write_scheduled = false;
+            group->write_config();
+        });
+        if (!posted) {
+            write_scheduled = false;
+            write_config();
+        }
+    }
+};
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// The cutoff dialog, kept apart from the rest of the plugin so that only the
+// plugins themselves need Qt.
+
+#include <cutoff_dialog.h>
+#include <freq_cutoff_plugin.h>
+
+void open_dialog(QWidget* parent_widget,
+                 const struct TS3Functions& ts3_functions, uint64 server_id,
+                 anyID client_id) {
+    const string dname = display_name(ts3_functions, server_id, client_id);
+    const string uname = resolve_id(ts3_functions, server_id, client_id);
+    ConfigureCutoffDialog* dialog =
+        new ConfigureCutoffDialog(dname, uname, *filter_group, parent_widget);
+    dialog->show();
+}
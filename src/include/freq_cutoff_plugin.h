@@ -20,7 +20,9 @@
 
 #pragma once
 
-#include <cutoff_dialog.h>
+#include <background_worker.h>
+#include <deferred_log.h>
+#include <filter_kernels.h>
 #include <freq_cutoff.h>
 
 #include <teamspeak/clientlib_publicdefinitions.h>
@@ -42,20 +44,71 @@ const char* freq_cutoff_description() {
 }
 
 unique_ptr<ApplicationFilterGroup> filter_group;
+KernelTable kernels;
+// for messages from the audio callback (run on the worker)
+unique_ptr<DeferredLog> audio_log;
+// The plugin's own thread, running from init to shutdown. Declared last so
+// that it also stops first if the plugin is torn down without a shutdown.
+unique_ptr<BackgroundWorker> worker;
 
 static const char* config_filename = "frequency_cutoff_plugin.conf";
 
+// Looks up the uid of a client in the client library and publishes it to the
+// audio callback. Returns the uid (empty if it could not be resolved). Only
+// called from the client event and GUI threads -- the audio callback never
+// enters the client library.
+string resolve_id(const struct TS3Functions& ts3_functions, uint64 server_id,
+                  anyID client_id) {
+    char* uname;
+    if (ts3_functions.getClientVariableAsString(
+            server_id, client_id, ClientProperties::CLIENT_UNIQUE_IDENTIFIER,
+            &uname) != ERROR_ok) {
+        log_error(ts3_functions,
+                  "Error resolving client identity for client id %i",
+                  client_id);
+        return string();
+    }
+    log_info(ts3_functions, "Resolving uid for client id %i -- found %s",
+             client_id, uname);
+
+    string uid = uname;
+    ts3_functions.freeMemory(uname);
+    if (!filter_group->add_client(server_id, client_id, uid)) {
+        log_error(ts3_functions,
+                  "Too many server connections, client id %i will not be "
+                  "filtered",
+                  client_id);
+    }
+    return uid;
+}
+
+// resolves every client currently known on a server
+void resolve_server(const struct TS3Functions& ts3_functions,
+                    uint64 server_id) {
+    anyID* client_ids;
+    if (ts3_functions.getClientList(server_id, &client_ids) != ERROR_ok) {
+        return;
+    }
+    for (anyID* client_id = client_ids; *client_id != 0; client_id++) {
+        resolve_id(ts3_functions, server_id, *client_id);
+    }
+    ts3_functions.freeMemory(client_ids);
+}
+
 int freq_cutoff_init(const char* config_path,
                      const struct TS3Functions& ts3_functions) {
-    try {
-        log_info(ts3_functions, "Config path: %s", config_path);
-        std::string name = std::string(config_path) + "/" + config_filename;
+    log_info(ts3_functions, "Config path: %s", config_path);
+    std::string name = std::string(config_path) + "/" + config_filename;
 
-        filter_group =
-            std::make_unique<ApplicationFilterGroup>(ts3_functions, name);
-
-        return 0;
+    worker = std::make_unique<BackgroundWorker>(ts3_functions);
+    audio_log = std::make_unique<DeferredLog>(ts3_functions, *worker);
+    try {
+        filter_group = std::make_unique<ApplicationFilterGroup>(
+            ts3_functions, name, default_filter_capacity, worker.get());
     } catch (...) {
+        // the plugin is unloaded, so its worker must not outlive this
+        worker.reset();
+        audio_log.reset();
         log_error(
             ts3_functions,
             "Error loading persisted settings. Most likely it has become "
@@ -64,37 +117,39 @@ int freq_cutoff_init(const char* config_path,
             config_filename, config_path);
         return 1;
     }
-}
 
-const char* freq_cutoff_infoTitle() { return freq_cutoff_name(); }
+    kernels = select_kernels();
+    log_info(ts3_functions, "Using %s filter kernel", kernels.name);
 
-void resolve_id(const struct TS3Functions& ts3_functions, uint64 server_id,
-                anyID client_id) {
-    ServerFilterGroup& server_filters =
-        filter_group->server_filter_groups[server_id];
-    if (!server_filters.resolvedIds.count(client_id) &&
-        !server_filters.unresolvableIds.count(client_id)) {
-        char* uname;
-        if (ts3_functions.getClientVariableAsString(
-                server_id, client_id,
-                ClientProperties::CLIENT_UNIQUE_IDENTIFIER,
-                &uname) != ERROR_ok) {
-            log_error(ts3_functions,
-                      "Error resolving client identity for client id %i",
-                      client_id);
-            server_filters.unresolvableIds.insert(client_id);
-        } else {
-            log_info(ts3_functions,
-                     "Resolving uid for client id %i -- found %s", client_id,
-                     uname);
+    // the plugin may be enabled while already connected
+    uint64* server_ids;
+    if (ts3_functions.getServerConnectionHandlerList(&server_ids) ==
+        ERROR_ok) {
+        for (uint64* server_id = server_ids; *server_id != 0; server_id++) {
+            resolve_server(ts3_functions, *server_id);
+        }
+        ts3_functions.freeMemory(server_ids);
+    }
 
-            server_filters.resolvedIds.emplace(client_id, uname);
+    return 0;
+}
 
-            ts3_functions.freeMemory(uname);
-        }
+// Stops the plugin's worker after running what was posted to it (including a
+// pending config write). The tasks refer to the rest of the plugin's state,
+// so the worker goes first. A write in progress is waited for, as it was when
+// the GUI thread wrote the config itself -- nothing may be left running the
+// plugin's code once the client unloads it.
+void freq_cutoff_shutdown(
+    [[maybe_unused]] const struct TS3Functions& ts3_functions) {
+    if (worker) {
+        worker->stop();
     }
+    worker.reset();
+    audio_log.reset();
 }
 
+const char* freq_cutoff_infoTitle() { return freq_cutoff_name(); }
+
 string display_name(const struct TS3Functions& ts3_functions, uint64 server_id,
                     anyID client_id) {
     char dname[DISPLAY_NAME_BUFSIZE];
@@ -109,111 +164,193 @@ string display_name(const struct TS3Functions& ts3_functions, uint64 server_id,
     return string(dname);
 }
 
-ButterworthFilter& get_filter(const struct TS3Functions& ts3_functions,
-                              ServerFilterGroup& server_filters,
-                              FilterConf& filter_conf, anyID client_id) {
-    if (server_filters.client_id_to_filter.count(client_id)) {
-        ButterworthFilter& filter =
-            server_filters.client_id_to_filter.at(client_id);
-        if (filter.cutoff_freq != filter_conf.coefficients.cutoff_freq) {
-            log_info(ts3_functions, "Updating filter cutoff for client id %i.",
-                     client_id);
-            filter = ButterworthFilter(filter_conf.coefficients.cutoff_freq);
+// The client's filter, updated to its conf and channel count. nullptr when
+// the pool has no record to spare, in which case the frame plays unfiltered.
+ButterworthFilter* get_filter(FilterPool& pool, ClientSlot& client,
+                              const FilterConf& filter_conf, anyID client_id,
+                              int channels) {
+    auto now = std::chrono::steady_clock::now();
+    ButterworthFilter* own = client.own_filter();
+    if (own == nullptr) {
+        FilterPool::Record* record =
+            pool.acquire(filter_conf.coefficients, now);
+        if (record == nullptr) {
+            if (!pool.exhausted) {
+                pool.exhausted = true;
+                audio_log->info(
+                    "All %i filters are in use, client id %i is not filtered.",
+                    (int)pool.capacity, client_id);
+            }
+            return nullptr;
         }
-        return filter;
+        pool.exhausted = false;
+        client.set_filter(record);
+        own = client.own_filter();
+        audio_log->info("Creating filter for client id %i.", client_id);
     } else {
-        log_info(ts3_functions, "Creating filter for client id %i.", client_id);
-        server_filters.client_id_to_filter.emplace(
-            client_id, ButterworthFilter(filter_conf.coefficients.cutoff_freq));
-        return server_filters.client_id_to_filter.at(client_id);
+        pool.touch(client.filter, now);
+    }
+
+    ButterworthFilter& filter = *own;
+    // equal designs share one cache entry, so comparing handles is enough
+    if (filter.coefficients != filter_conf.coefficients) {
+        audio_log->info("Updating filter cutoff for client id %i.",
+                        client_id);
+        filter.retarget(filter_conf.coefficients);
+    }
+    if (filter.kernel == nullptr || filter.kernel_channels != channels) {
+        filter.kernel = kernels.get(filter.coefficients->order, channels);
+        filter.kernel_channels = channels;
+    }
+    return &filter;
+}
+
+// number of designs a retarget sweeps through (the coefficients are
+// interpolated linearly between them, sample by sample)
+constexpr int retarget_steps = 32;
+
+// Runs the filter over a frame. In the frame after a retarget the filter
+// sweeps from the old design to the new one, which avoids the transient of
+// switching (or restarting) the filter abruptly. The intermediate designs live
+// on the stack, so this does not allocate.
+void run_filter(ButterworthFilter& filter, short* samples, int sample_count,
+                int channels) {
+    if (!filter.fade_from) {
+        filter.kernel(*filter.coefficients, filter, samples, sample_count,
+                      channels);
+        return;
+    }
+
+#ifdef FREQ_CUTOFF_FIXED
+    auto ramp_kernel = filter_fixed_ramp;
+#else
+    auto ramp_kernel = filter_biquad_ramp;
+#endif
+    const ButterworthCoefficients& from = *filter.fade_from;
+    const ButterworthCoefficients& to = *filter.coefficients;
+    int steps = std::min(retarget_steps, sample_count);
+    ButterworthCoefficients start(from, to, 0.0);
+    int done = 0;
+    for (int i = 1; i <= steps; i++) {
+        int end = (int)((int64_t)sample_count * i / steps);
+        ButterworthCoefficients step(from, to, (double)i / steps);
+        ramp_kernel(start, step, filter, samples + done * channels,
+                    end - done, channels);
+        start = step;
+        done = end;
+    }
+    // the cache still holds the old design, so this does not free it
+    filter.fade_from.reset();
+}
+
+void freq_cutoff_onConnectStatusChangeEvent(
+    const struct TS3Functions& ts3_functions, uint64 server_id,
+    int new_status) {
+    if (new_status == STATUS_CONNECTION_ESTABLISHED) {
+        resolve_server(ts3_functions, server_id);
+    } else if (new_status == STATUS_DISCONNECTED) {
+        filter_group->retire_server(server_id);
+    }
+    filter_group->sweep();
+}
+
+// Covers every way a client enters or leaves our view (moves, subscriptions,
+// timeouts, kicks). A client id is only handed to a new client when it
+// enters, so its uid is (re)resolved then. A client that leaves is retired:
+// its audio can still play after the event, so its state is only dropped
+// after a grace period.
+void freq_cutoff_onClientMoveEvent(const struct TS3Functions& ts3_functions,
+                                   uint64 server_id, anyID client_id,
+                                   int visibility) {
+    if (visibility == ENTER_VISIBILITY) {
+        resolve_id(ts3_functions, server_id, client_id);
+    } else if (visibility == LEAVE_VISIBILITY) {
+        filter_group->retire_client(server_id, client_id);
     }
+    filter_group->sweep();
 }
 
-// For simplicitly, we never actually clean up the server and client maps --
-// this will cause them to grow without bound as servers are joined and new
-// users speak. Fixing this is difficult for two reasons: 1) there are many ways
-// a user can leave our "scope" (moving channels, leaving server, getting
-// kicked, etc) and a similar number of ways a server can disappear. 2) the
-// events that indicate such changes are not synchronized with the audio played
-// during this event (e.g. audio from a user can play after we have received
-// their "left server" event. Because of these difficulties in exactly tracking
-// what filters are possibily accessible, we simply never clean up the filters.
-// The amount of memory used is very small. One map entry per server, one map
-// entry per client with an active filter, and 4x the filter order size (e.g.
-// 4x8 doubles) for filter coefficients and buffer.
+// catches clients whose uid was not available yet when they appeared
+void freq_cutoff_onUpdateClientEvent(const struct TS3Functions& ts3_functions,
+                                     uint64 server_id, anyID client_id) {
+    if (filter_group->uids.find(server_id, client_id) == nullptr) {
+        resolve_id(ts3_functions, server_id, client_id);
+    }
+    filter_group->sweep();
+}
+
+// The servers and client slots are only created and dropped by the client
+// events: the audio callback reads them lock free and never allocates. Leave
+// events are not synchronized with the audio (e.g. audio from a user can play
+// after we have received their "left server" event), so a client that left
+// keeps its slot for a grace period, and what is dropped is only freed once
+// the audio callback has moved past it (the uids of the clients included).
+// Memory then follows the servers and clients currently in view.
+//
+// The filters themselves are bounded by the filter pool, which takes the
+// record of a client that has stopped speaking when it runs out.
 //
-// Other solutions could include: removing servers/clients based on timeout or
-// removing them based on map size (i.e. maximum number of active filters)
+// Per frame, the client's slot is a single indexed load. Its uid is resolved
+// ahead of time from the client events (a client that has not been resolved
+// yet plays unfiltered) and its conf is only looked up again when the confs
+// change.
 //
-// The use of the shared server and filter maps means that this function is not
-// thread safe. Empirically, it is observed that this function is not called
-// concurrently (even if there are multiple users talking), but I don't see a
-// clear guarantee of that in the documentation
+// Each server is a shard of its own: its slots, filters and filter pool are
+// only written by the audio callbacks of that server, so callbacks for
+// different servers may run in parallel without sharing anything writable.
+// Callbacks of the same server are not expected to overlap, but that is not
+// documented either -- a callback that finds its server claimed by another
+// one passes its audio through unfiltered rather than wait.
 void freq_cutoff_onEditPlaybackVoiceDataEvent(
     const struct TS3Functions& ts3_functions, uint64 server_id, anyID client_id,
     short* samples, int sample_count, int channels) {
-    resolve_id(ts3_functions, server_id, client_id);
-    ServerFilterGroup& server_filters =
-        filter_group->server_filter_groups[server_id];
-    if (server_filters.resolvedIds.count(client_id)) {
-        const string& uname = server_filters.resolvedIds[client_id];
-        shared_ptr<map<const string, FilterConf>> confs =
-            filter_group->load_atomic();
-
-        if (confs->count(uname)) {
-            FilterConf& filter_conf = confs->at(uname);
-            if (filter_conf.enabled) {
-                ButterworthFilter& filter = get_filter(
-                    ts3_functions, server_filters, filter_conf, client_id);
-
-                ButterworthCoefficients& coefficients =
-                    filter_conf.coefficients;
-
-                for (int c = 0; c < channels; c++) {
-                    ButterworthChannelFilter& channel_filter =
-                        filter.channel_map[c];
-                    for (int s = 0; s < sample_count; s++) {
-                        double new_x = (double)samples[s * channels + c];
-                        double new_y = (coefficients.b[0]) * new_x;
-                        for (int i = 1; i <= buffer_size; i++) {
-                            new_y += (coefficients.b[i] *
-                                      channel_filter.x[(channel_filter.index -
-                                                        i + buffer_size) %
-                                                       buffer_size]);
-                            new_y -= (coefficients.a[i] *
-                                      channel_filter.y[(channel_filter.index -
-                                                        i + buffer_size) %
-                                                       buffer_size]);
-                        }
-
-                        channel_filter.x[channel_filter.index % buffer_size] =
-                            new_x;
-                        channel_filter.y[channel_filter.index % buffer_size] =
-                            new_y;
-                        for (int c = 0; c < channels; c++) {
-                            samples[s * channels + c] = (short)new_y;
-                        }
-                        channel_filter.index =
-                            (channel_filter.index + 1) % buffer_size;
-                    }
+    // there is only filter state (and a kernel) for 1 to max_channels
+    if (channels < 1 || channels > max_channels) {
+        return;
+    }
+    uint64_t generation = filter_group->conf_generation();
+    auto servers = filter_group->read_servers();
+    const ServerFilterGroup* server =
+        filter_group->audio_server(servers.snapshot, server_id);
+    if (server == nullptr) {
+        return;
+    }
+    ClientSlot* slot = server->client(client_id);
+    ServerAudioState::Claim claim(*server->audio);
+    if (slot == nullptr || !claim.owned) {
+        return;
+    }
+    ClientSlot& client = *slot;
+    FilterPool& pool = server->audio->filter_pool;
+    const InternedUid* uid = filter_group->uids.find(server_id, client_id);
+    uint64_t uid_serial = uid == nullptr ? 0 : uid->serial;
+    if (client.uid_serial != uid_serial) {
+        client.set_uid(uid_serial, pool);
+    }
+    // most speakers have no filter -- they stop here until the confs change
+    if (client.unfiltered_generation == generation) {
+        return;
+    }
+
+    if (uid != nullptr) {
+        auto confs = filter_group->read_confs();
+        const FilterConf* filter_conf =
+            client.lookup_conf(confs.snapshot, *uid);
+        generation = confs.snapshot.generation;
+
+        if (filter_conf != nullptr) {
+            if (filter_conf->enabled) {
+                ButterworthFilter* filter = get_filter(
+                    pool, client, *filter_conf, client_id, channels);
+                if (filter != nullptr) {
+                    DenormalGuard denormal_guard;
+                    run_filter(*filter, samples, sample_count, channels);
                 }
                 return;
             }
         } else {
-            server_filters.client_id_to_filter.erase(client_id);
+            client.release_filter(pool);
         }
     }
-}
-
-void open_dialog(QWidget* parent_widget,
-                 const struct TS3Functions& ts3_functions, uint64 server_id,
-                 anyID client_id) {
-    const string dname = display_name(ts3_functions, server_id, client_id);
-    ServerFilterGroup& server_filters =
-        filter_group->server_filter_groups[server_id];
-    resolve_id(ts3_functions, server_id, client_id);
-    const string& uname = server_filters.resolvedIds[client_id];
-    ConfigureCutoffDialog* dialog =
-        new ConfigureCutoffDialog(dname, uname, *filter_group, parent_widget);
-    dialog->show();
+    client.unfiltered_generation = generation;
 }
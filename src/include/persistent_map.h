@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+// An immutable ordered map. Every edit returns a new map that shares all the
+// nodes the edit did not touch with the old one (path copying on an AVL
+// tree), so an edit costs O(log n) new nodes and copying a map is copying a
+// pointer. Old versions stay valid for as long as anyone holds them.
+//
+// Lookups walk raw pointers and never touch the reference counts, so a map
+// kept alive by someone else (e.g. a published snapshot) can be read from the
+// audio thread.
+template <typename K, typename V>
+class PersistentMap {
+   private:
+    class Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    class Node {
+       public:
+        K key;
+        V value;
+        NodePtr left;
+        NodePtr right;
+        int height;
+
+        Node(const K& key, const V& value, NodePtr left, NodePtr right)
+            : key(key),
+              value(value),
+              left(std::move(left)),
+              right(std::move(right)),
+              height(1 + std::max(height_of(this->left),
+                                  height_of(this->right))){};
+    };
+
+    NodePtr root;
+    size_t count = 0;
+
+    PersistentMap(NodePtr root, size_t count)
+        : root(std::move(root)), count(count){};
+
+    static int height_of(const NodePtr& node) {
+        return node ? node->height : 0;
+    }
+
+    // the middle entry on top of the trees of the halves either side of it
+    template <typename It>
+    static NodePtr build(It first, size_t count) {
+        if (count == 0) {
+            return nullptr;
+        }
+        size_t half = count / 2;
+        It middle = std::next(first, half);
+        NodePtr left = build(first, half);
+        NodePtr right = build(std::next(middle), count - half - 1);
+        return std::make_shared<const Node>(middle->first, middle->second,
+                                            std::move(left), std::move(right));
+    }
+
+    static NodePtr make(const Node& from, NodePtr left, NodePtr right) {
+        return std::make_shared<const Node>(from.key, from.value,
+                                            std::move(left), std::move(right));
+    }
+
+    // Rebuilds a node from its (already rebuilt) children, with at most one
+    // rotation to restore the AVL balance.
+    static NodePtr balance(const Node& top, NodePtr left, NodePtr right) {
+        int difference = height_of(left) - height_of(right);
+        if (difference > 1) {
+            if (height_of(left->left) < height_of(left->right)) {
+                const Node& pivot = *left->right;
+                return make(pivot, make(*left, left->left, pivot.left),
+                            make(top, pivot.right, right));
+            }
+            return make(*left, left->left, make(top, left->right, right));
+        }
+        if (difference < -1) {
+            if (height_of(right->right) < height_of(right->left)) {
+                const Node& pivot = *right->left;
+                return make(pivot, make(top, left, pivot.left),
+                            make(*right, pivot.right, right->right));
+            }
+            return make(*right, make(top, left, right->left), right->right);
+        }
+        return make(top, std::move(left), std::move(right));
+    }
+
+    static NodePtr insert(const NodePtr& node, const K& key, const V& value,
+                          bool& added) {
+        if (!node) {
+            added = true;
+            return std::make_shared<const Node>(key, value, nullptr, nullptr);
+        }
+        if (key < node->key) {
+            return balance(*node, insert(node->left, key, value, added),
+                           node->right);
+        }
+        if (node->key < key) {
+            return balance(*node, node->left,
+                           insert(node->right, key, value, added));
+        }
+        return std::make_shared<const Node>(key, value, node->left,
+                                            node->right);
+    }
+
+    static NodePtr remove_min(const NodePtr& node, const Node*& min) {
+        if (!node->left) {
+            min = node.get();
+            return node->right;
+        }
+        return balance(*node, remove_min(node->left, min), node->right);
+    }
+
+    static NodePtr remove(const NodePtr& node, const K& key, bool& removed) {
+        if (!node) {
+            return node;
+        }
+        if (key < node->key) {
+            return balance(*node, remove(node->left, key, removed),
+                           node->right);
+        }
+        if (node->key < key) {
+            return balance(*node, node->left,
+                           remove(node->right, key, removed));
+        }
+        removed = true;
+        if (!node->left) {
+            return node->right;
+        }
+        if (!node->right) {
+            return node->left;
+        }
+        const Node* successor = nullptr;
+        NodePtr right = remove_min(node->right, successor);
+        return balance(*successor, node->left, right);
+    }
+
+    template <typename F>
+    static void visit(const Node* node, F& f) {
+        if (node != nullptr) {
+            visit(node->left.get(), f);
+            f(node->key, node->value);
+            visit(node->right.get(), f);
+        }
+    }
+
+   public:
+    PersistentMap() = default;
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    // nullptr if the key is missing -- the pointer lives as long as this
+    // version of the map
+    const V* find(const K& key) const {
+        const Node* node = root.get();
+        while (node != nullptr) {
+            if (key < node->key) {
+                node = node->left.get();
+            } else if (node->key < key) {
+                node = node->right.get();
+            } else {
+                return &node->value;
+            }
+        }
+        return nullptr;
+    }
+
+    bool contains(const K& key) const { return find(key) != nullptr; }
+
+    // a version with key set to value (inserted or replaced)
+    PersistentMap set(const K& key, const V& value) const {
+        bool added = false;
+        NodePtr new_root = insert(root, key, value, added);
+        return PersistentMap(std::move(new_root), count + (added ? 1 : 0));
+    }
+
+    // a version without key
+    PersistentMap erase(const K& key) const {
+        bool removed = false;
+        NodePtr new_root = remove(root, key, removed);
+        if (!removed) {
+            return *this;
+        }
+        return PersistentMap(std::move(new_root), count - 1);
+    }
+
+    // A map of the given entries, which have to be sorted by key without
+    // duplicates. Builds the balanced tree directly, in O(n) nodes rather
+    // than the O(n log n) of setting one entry at a time.
+    template <typename It>
+    static PersistentMap from_sorted(It first, It last) {
+        size_t count = std::distance(first, last);
+        return PersistentMap(build(first, count), count);
+    }
+
+    // calls f(key, value) for every entry, in key order
+    template <typename F>
+    void for_each(F f) const {
+        visit(root.get(), f);
+    }
+
+    bool operator==(const PersistentMap& other) const {
+        if (root == other.root) {
+            return true;
+        }
+        if (count != other.count) {
+            return false;
+        }
+        bool equal = true;
+        for_each([&](const K& key, const V& value) {
+            const V* other_value = other.find(key);
+            equal = equal && other_value != nullptr && *other_value == value;
+        });
+        return equal;
+    }
+
+    bool operator!=(const PersistentMap& other) const {
+        return !(*this == other);
+    }
+};
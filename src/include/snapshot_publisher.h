@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Publishes immutable snapshots of a value to realtime readers (RCU style).
+//
+// Readers do not take locks or touch reference counts: a read announces the
+// current epoch in a free reader slot (one compare and swap on the slot's own
+// cache line), then picks up the current snapshot with a plain load. Writers
+// swap in a new snapshot and retire the old one, tagged with a new epoch. A
+// retired snapshot is freed by reclaim() once no reader is still inside a read
+// that started before it was retired -- reclaim() is only ever called from the
+// writer's (non-realtime) side.
+//
+// Writers are serialized by a mutex, which also makes copy() (for the GUI,
+// which is a writer itself) consistent. Other things the readers reach while
+// inside a read can be handed to retire() once they are unreachable, and are
+// freed the same way.
+template <typename T>
+class SnapshotPublisher {
+   public:
+    class Snapshot {
+       public:
+        // 1 for the first publish and counting up from there
+        uint64_t generation;
+        T value;
+
+        Snapshot(uint64_t generation, T value)
+            : generation(generation), value(std::move(value)){};
+    };
+
+    // Reads that can be in progress at once -- a further one falls back to
+    // reading under the writer mutex
+    static constexpr int max_readers = 16;
+
+    // The read side. The snapshot stays valid until the guard goes out of
+    // scope.
+    class ReadGuard {
+       private:
+        SnapshotPublisher& publisher;
+        int reader;
+
+       public:
+        const Snapshot& snapshot;
+
+        ReadGuard(SnapshotPublisher& publisher, int reader,
+                  const Snapshot& snapshot)
+            : publisher(publisher), reader(reader), snapshot(snapshot){};
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        ~ReadGuard() {
+            if (reader >= 0) {
+                publisher.readers[reader].epoch.store(
+                    0, std::memory_order_release);
+            } else {
+                publisher.writer_mutex.unlock();
+            }
+        }
+    };
+
+   private:
+    class alignas(64) Reader {
+       public:
+        // epoch the reader entered at, 0 while the slot is free
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    std::atomic<Snapshot*> current{nullptr};
+    std::atomic<uint64_t> generation{0};
+    std::atomic<uint64_t> epoch{1};
+    Reader readers[max_readers];
+
+    std::mutex writer_mutex;
+    // snapshots (and anything else retired) that readers may still be
+    // using, with the epoch they were retired at
+    std::vector<std::pair<uint64_t, std::shared_ptr<const void>>> retired;
+
+    // Takes a free reader slot for the duration of one read by announcing
+    // entered in it, or returns -1 if every slot is in use. Each thread
+    // starts at the slot it used last, which is free unless another read is
+    // in progress there, so the first attempt normally succeeds. Nothing is
+    // held between reads, so threads can come and go freely.
+    int enter_reader(uint64_t entered) {
+        static thread_local int last_reader = 0;
+        for (int i = 0; i < max_readers; i++) {
+            int reader = (last_reader + i) % max_readers;
+            uint64_t expected = 0;
+            if (readers[reader].epoch.compare_exchange_strong(
+                    expected, entered, std::memory_order_seq_cst)) {
+                last_reader = reader;
+                return reader;
+            }
+        }
+        return -1;
+    }
+
+    void reclaim_locked() {
+        // Pairs with read(): a reader either loads the new snapshot or its
+        // announcement is seen here.
+        uint64_t oldest = UINT64_MAX;
+        for (Reader& reader : readers) {
+            uint64_t entered = reader.epoch.load(std::memory_order_seq_cst);
+            if (entered != 0 && entered < oldest) {
+                oldest = entered;
+            }
+        }
+        // a reader that entered at or after the retirement epoch can only
+        // have seen a later snapshot (and nothing else retired by then)
+        auto still_used = [oldest](const auto& r) { return r.first > oldest; };
+        retired.erase(
+            std::partition(retired.begin(), retired.end(), still_used),
+            retired.end());
+    }
+
+    void retire_locked(std::shared_ptr<const void> garbage) {
+        uint64_t retired_at = epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        retired.emplace_back(retired_at, std::move(garbage));
+    }
+
+   public:
+    SnapshotPublisher(T value) { publish(std::move(value)); }
+
+    SnapshotPublisher(const SnapshotPublisher&) = delete;
+    SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+    ~SnapshotPublisher() { delete current.load(); }
+
+    // generation of the current snapshot -- one load, for readers that only
+    // need to know whether anything changed since they last looked
+    uint64_t current_generation() const {
+        return generation.load(std::memory_order_acquire);
+    }
+
+    ReadGuard read() {
+        // The announcement has to be visible before the snapshot is loaded
+        // (both are sequentially consistent), otherwise a writer could retire
+        // and free what we are about to pick up.
+        int reader = enter_reader(epoch.load(std::memory_order_acquire));
+        if (reader < 0) {
+            writer_mutex.lock();
+            return ReadGuard(*this, -1,
+                             *current.load(std::memory_order_acquire));
+        }
+        return ReadGuard(*this, reader,
+                         *current.load(std::memory_order_seq_cst));
+    }
+
+    T copy() {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        return current.load(std::memory_order_relaxed)->value;
+    }
+
+    void publish(T value) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        uint64_t next = generation.load(std::memory_order_relaxed) + 1;
+        Snapshot* old = current.exchange(new Snapshot(next, std::move(value)),
+                                         std::memory_order_seq_cst);
+        generation.store(next, std::memory_order_release);
+        if (old != nullptr) {
+            retire_locked(std::shared_ptr<const Snapshot>(old));
+        }
+        reclaim_locked();
+    }
+
+    // Frees garbage once no read that started before this call is still in
+    // progress. It must already be out of reach of new reads (e.g. removed
+    // from wherever readers look it up).
+    void retire(std::shared_ptr<const void> garbage) {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        retire_locked(std::move(garbage));
+        reclaim_locked();
+    }
+
+    // frees what readers have moved past since the last publish
+    void reclaim() {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        reclaim_locked();
+    }
+};
@@ -20,6 +20,9 @@
 
 #pragma once
 
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <string>
 
 #include <ts3_functions.h>
@@ -27,32 +30,51 @@
 using std::string;
 using std::unique_ptr;
 
+// size of the stack buffer a log message is formatted into -- longer messages
+// are truncated
+constexpr const size_t log_buffer_size = 1024;
+
+// Formats into the caller's buffer (e.g. on the stack) without allocating. A
+// message that does not fit is cut off and ends in "...". Returns the length
+// written.
 template <typename... Args>
-string string_format(const string& format, Args... args) {
-    size_t size = snprintf(nullptr, 0, format.c_str(), args...) + 1;
-    unique_ptr<char[]> buf(new char[size]);
-    snprintf(buf.get(), size, format.c_str(), args...);
-    return string(buf.get(), buf.get() + size - 1);
+size_t format_into(char* buffer, size_t size, const char* format,
+                   Args... args) {
+    int length = snprintf(buffer, size, format, args...);
+    if (length < 0) {
+        buffer[0] = '\0';
+        return 0;
+    }
+    if ((size_t)length >= size) {
+        const char marker[] = "...";
+        if (size >= sizeof(marker)) {
+            memcpy(buffer + size - sizeof(marker), marker, sizeof(marker));
+        }
+        return size - 1;
+    }
+    return length;
 }
 
 static const char* freq_cutoff_name() { return "Frequency Cutoff Plugin"; }
 
+// The message is formatted on the stack, so logging does not allocate (the
+// format is taken as a plain pointer for the same reason).
 template <typename... Args>
 void log(const struct TS3Functions& ts3Functions, enum LogLevel log_level,
-         const string& format, Args... args) {
-    ts3Functions.logMessage(string_format(format, args...).c_str(), log_level,
-                            freq_cutoff_name(), 0);
+         const char* format, Args... args) {
+    char message[log_buffer_size];
+    format_into(message, sizeof(message), format, args...);
+    ts3Functions.logMessage(message, log_level, freq_cutoff_name(), 0);
 }
 
 template <typename... Args>
-void log_info(const struct TS3Functions& ts3Functions,
-              const string& format, Args... args) {
+void log_info(const struct TS3Functions& ts3Functions, const char* format,
+              Args... args) {
     log(ts3Functions, LogLevel::LogLevel_INFO, format, args...);
 }
 
 template <typename... Args>
-void log_error(const struct TS3Functions& ts3Functions,
-               const string& format, Args... args) {
+void log_error(const struct TS3Functions& ts3Functions, const char* format,
+               Args... args) {
     log(ts3Functions, LogLevel::LogLevel_INFO, format, args...);
 }
-
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <teamspeak/public_definitions.h>
+
+// The unique identifiers of the clients on each server connection, resolved
+// from the client events and read by the audio callback without locks.
+//
+// Each distinct uid is interned once, with a count of the clients it is
+// published for, and released when the last of them is cleared. A reader may
+// still be using a uid it loaded before the clear, so released uids are not
+// freed here: the owner takes them (see take_released) and frees them once no
+// reader can be using them any more. Memory then follows the users in view.
+//
+// Writers (the client event and GUI threads) are serialized by a mutex.
+class InternedUid {
+   public:
+    const std::string value;
+    // unique for the life of the process -- unlike the address, which a later
+    // uid may be given once this one is freed
+    const uint64_t serial;
+
+    InternedUid(const std::string& value, uint64_t serial)
+        : value(value), serial(serial){};
+
+   private:
+    friend class UidTable;
+    // clients the uid is published for, only used by the writers
+    size_t references = 0;
+};
+
+class UidTable {
+   public:
+    // server connections tracked at once -- the clients of further servers
+    // stay unresolved (and unfiltered)
+    static constexpr int max_servers = 32;
+
+    // clients per page of uids
+    static constexpr int page_bits = 8;
+
+   private:
+    static constexpr int page_size = 1 << page_bits;
+    static constexpr int page_count =
+        (std::numeric_limits<anyID>::max() >> page_bits) + 1;
+
+    class Page {
+       public:
+        std::atomic<const InternedUid*> uids[page_size] = {};
+    };
+
+    // A server connection's uids, split into pages of client ids like the
+    // client slots. A slot is claimed for a server when one of its clients is
+    // first resolved and freed (with its pages kept for the next server) when
+    // it disconnects.
+    class Server {
+       public:
+        // 0 while the slot is free (0 is never a server connection handler)
+        std::atomic<uint64> id{0};
+        std::atomic<Page*> pages[page_count] = {};
+    };
+
+    Server servers[max_servers];
+    std::mutex write_lock;
+    // keyed on the value of the uid itself
+    std::map<std::string_view, std::unique_ptr<InternedUid>> interned;
+    uint64_t last_serial = 0;
+    std::vector<std::unique_ptr<const InternedUid>> released;
+    std::vector<std::unique_ptr<Page>> owned_pages;
+
+    const InternedUid* acquire(const std::string& uid) {
+        auto found = interned.find(uid);
+        if (found == interned.end()) {
+            auto interned_uid =
+                std::make_unique<InternedUid>(uid, ++last_serial);
+            std::string_view key = interned_uid->value;
+            found = interned.emplace(key, std::move(interned_uid)).first;
+        }
+        found->second->references++;
+        return found->second.get();
+    }
+
+    // stores uid (or nullptr) in an entry, releasing the uid it held
+    void store(std::atomic<const InternedUid*>& entry,
+               const InternedUid* uid) {
+        const InternedUid* old = entry.load(std::memory_order_relaxed);
+        entry.store(uid, std::memory_order_release);
+        if (old == nullptr) {
+            return;
+        }
+        auto found = interned.find(old->value);
+        if (--found->second->references == 0) {
+            released.emplace_back(std::move(found->second));
+            interned.erase(found);
+        }
+    }
+
+    Server* find_server(uint64 server_id) {
+        for (Server& server : servers) {
+            if (server.id.load(std::memory_order_relaxed) == server_id) {
+                return &server;
+            }
+        }
+        return nullptr;
+    }
+
+    Server* claim_server(uint64 server_id) {
+        Server* server = find_server(server_id);
+        if (server == nullptr) {
+            server = find_server(0);
+            if (server != nullptr) {
+                server->id.store(server_id, std::memory_order_release);
+            }
+        }
+        return server;
+    }
+
+   public:
+    // The uid of a client, or nullptr if it is not known. Lock free, for the
+    // audio callback -- the uid stays valid until the owner frees it, which
+    // it only does once the reads that may have found it are over.
+    const InternedUid* find(uint64 server_id, anyID client_id) const {
+        for (const Server& server : servers) {
+            if (server.id.load(std::memory_order_acquire) != server_id) {
+                continue;
+            }
+            const Page* page = server.pages[client_id >> page_bits].load(
+                std::memory_order_acquire);
+            if (page == nullptr) {
+                return nullptr;
+            }
+            const InternedUid* uid =
+                page->uids[client_id & (page_size - 1)].load(
+                    std::memory_order_acquire);
+            // the slot may have been handed to another server since it was
+            // matched, in which case the uid is not this server's
+            if (server.id.load(std::memory_order_relaxed) != server_id) {
+                return nullptr;
+            }
+            return uid;
+        }
+        return nullptr;
+    }
+
+    // Returns false if there is no room left for another server.
+    bool publish(uint64 server_id, anyID client_id, const std::string& uid) {
+        std::lock_guard<std::mutex> lock(write_lock);
+        Server* server = claim_server(server_id);
+        if (server == nullptr) {
+            return false;
+        }
+        std::atomic<Page*>& page_ref = server->pages[client_id >> page_bits];
+        Page* page = page_ref.load(std::memory_order_relaxed);
+        if (page == nullptr) {
+            owned_pages.emplace_back(new Page());
+            page = owned_pages.back().get();
+            page_ref.store(page, std::memory_order_release);
+        }
+        store(page->uids[client_id & (page_size - 1)], acquire(uid));
+        return true;
+    }
+
+    void clear(uint64 server_id, anyID client_id) {
+        std::lock_guard<std::mutex> lock(write_lock);
+        Server* server = find_server(server_id);
+        if (server == nullptr) {
+            return;
+        }
+        Page* page = server->pages[client_id >> page_bits].load(
+            std::memory_order_relaxed);
+        if (page != nullptr) {
+            store(page->uids[client_id & (page_size - 1)], nullptr);
+        }
+    }
+
+    // whether any client in the same page of ids as client_id has a uid
+    bool page_in_use(uint64 server_id, anyID client_id) {
+        std::lock_guard<std::mutex> lock(write_lock);
+        Server* server = find_server(server_id);
+        if (server == nullptr) {
+            return false;
+        }
+        Page* page = server->pages[client_id >> page_bits].load(
+            std::memory_order_relaxed);
+        if (page == nullptr) {
+            return false;
+        }
+        for (std::atomic<const InternedUid*>& uid : page->uids) {
+            if (uid.load(std::memory_order_relaxed) != nullptr) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Forgets the uids of a server's clients and frees its slot.
+    void clear_server(uint64 server_id) {
+        std::lock_guard<std::mutex> lock(write_lock);
+        Server* server = find_server(server_id);
+        if (server == nullptr) {
+            return;
+        }
+        // release the slot before clearing it, so that a reader that picks
+        // up a uid stored after this also sees the slot change
+        server->id.store(0, std::memory_order_release);
+        for (std::atomic<Page*>& page_ref : server->pages) {
+            Page* page = page_ref.load(std::memory_order_relaxed);
+            if (page != nullptr) {
+                for (std::atomic<const InternedUid*>& uid : page->uids) {
+                    store(uid, nullptr);
+                }
+            }
+        }
+    }
+
+    // The uids no client holds any more since the last call. Readers may
+    // still be using them, so the caller frees them once that is over.
+    std::vector<std::unique_ptr<const InternedUid>> take_released() {
+        std::lock_guard<std::mutex> lock(write_lock);
+        std::vector<std::unique_ptr<const InternedUid>> taken;
+        taken.swap(released);
+        return taken;
+    }
+};
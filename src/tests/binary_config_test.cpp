@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Round trips config entries through the binary format (encode, map, look
+// up), checks that a corrupt or truncated file is refused, and that the
+// plugin falls back to the text config when its binary config is refused.
+//
+//   frequency_cutoff_binary_config_test config_dir
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <freq_cutoff.h>
+
+#include <teamspeak/public_errors.h>
+
+int failures = 0;
+// everything the plugin logged (its errors are logged at info level too)
+std::string logged;
+
+void check(bool passed, const char* what) {
+    if (!passed) {
+        printf("failed: %s\n", what);
+        failures++;
+    }
+}
+
+unsigned int log_message(const char* message, LogLevel, const char*, uint64) {
+    logged += message;
+    logged += '\n';
+    return ERROR_ok;
+}
+
+void write_file(const std::string& filename, const std::string& contents) {
+    std::ofstream(filename, std::ios::binary) << contents;
+}
+
+ConfigLine config_line(std::string_view name, int cutoff_freq, bool enabled,
+                       int order) {
+    ConfigLine line;
+    line.name = name;
+    line.cutoff_freq = cutoff_freq;
+    line.enabled = enabled;
+    line.order = order;
+    return line;
+}
+
+bool same_line(const ConfigLine& a, const ConfigLine& b) {
+    return a.name == b.name && a.cutoff_freq == b.cutoff_freq &&
+           a.enabled == b.enabled && a.order == b.order;
+}
+
+// true if the file is refused as a binary config
+bool refused(const std::string& filename) {
+    try {
+        BinaryConfig config(filename);
+        return false;
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+}
+
+void test_round_trip(const std::string& filename) {
+    // sorted by name, with names around the key width (8 bytes)
+    const std::vector<ConfigLine> lines = {
+        config_line("A", 100, true, 2),
+        config_line("ABCDEFGH", 1000, false, 0),
+        config_line("ABCDEFGHI", 2500, true, 8),
+        config_line("xs1pN0Y3kE+dXnFAbbHOrYbJqf0=", 9000, true, 4),
+    };
+    write_file(filename, encode_binary_config(lines));
+    BinaryConfig config(filename);
+    check(config.size() == lines.size(), "round trip size");
+    for (size_t i = 0; i < lines.size(); i++) {
+        check(same_line(config.entry(i), lines[i]), "round trip entry");
+        ConfigLine found;
+        check(config.find(lines[i].name, found) && same_line(found, lines[i]),
+              "round trip find");
+    }
+    ConfigLine found;
+    for (const char* missing : {"", "0", "AB", "ABCDEFGHIJ", "zz"}) {
+        check(!config.find(missing, found), "find of a missing uid");
+    }
+
+    write_file(filename, encode_binary_config({}));
+    check(BinaryConfig(filename).size() == 0, "empty round trip");
+}
+
+void test_corrupt(const std::string& filename) {
+    std::string valid =
+        encode_binary_config({config_line("uid1", 1000, true, 4),
+                              config_line("uid2", 2000, true, 4)});
+
+    write_file(filename, "");
+    check(refused(filename), "empty file");
+    write_file(filename, valid.substr(0, BinaryConfig::header_size - 1));
+    check(refused(filename), "truncated header");
+    write_file(filename, valid.substr(0, valid.size() - 1));
+    check(refused(filename), "truncated entry");
+    write_file(filename, valid + "x");
+    check(refused(filename), "trailing bytes");
+
+    std::string corrupt = valid;
+    corrupt[0] = 'X';
+    write_file(filename, corrupt);
+    check(refused(filename), "bad magic");
+    corrupt = valid;
+    corrupt[4] = 2;
+    write_file(filename, corrupt);
+    check(refused(filename), "unknown version");
+    corrupt = valid;
+    corrupt[8] = 12;
+    write_file(filename, corrupt);
+    check(refused(filename), "unaligned key width");
+    corrupt = valid;
+    corrupt[12] = 3;
+    write_file(filename, corrupt);
+    check(refused(filename), "entry count past the end");
+}
+
+void test_fallback(const std::string& config_filename) {
+    static TS3Functions ts3_functions;
+    ts3_functions.logMessage = log_message;
+    std::string binary_filename = binary_config_name(config_filename);
+    write_file(config_filename, "uid1 1000 1 4\nuid2 2000 0\n");
+    write_file(binary_filename, "FCUT");
+
+    logged.clear();
+    ApplicationFilterGroup filter_group(ts3_functions, config_filename);
+    ConfMap confs = filter_group.load_confs();
+    const FilterConf* conf = confs.find("uid1");
+    check(confs.size() == 2 && conf != nullptr &&
+              conf->coefficients->cutoff_freq == 1000,
+          "fallback to the text config");
+    check(logged.find("Could not load the binary config") !=
+                  std::string::npos &&
+              logged.find(binary_filename) != std::string::npos,
+          "fallback names the binary config");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s config_dir\n", argv[0]);
+        return 2;
+    }
+    std::string config_dir = argv[1];
+    std::filesystem::remove_all(config_dir);
+    std::filesystem::create_directories(config_dir);
+
+    test_round_trip(config_dir + "/round_trip.bin");
+    test_corrupt(config_dir + "/corrupt.bin");
+    test_fallback(config_dir + "/frequency_cutoff_plugin.conf");
+    printf("%i failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
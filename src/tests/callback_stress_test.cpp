@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Runs the playback callback from several threads at once (two per server, so
+// callbacks for the same server overlap as well) while client events connect
+// and disconnect servers and move clients in and out, and a GUI thread edits
+// and saves the confs. Meant to be run under ThreadSanitizer (configure with
+// FREQ_CUTOFF_TSAN), which reports any race it sees.
+//
+//   frequency_cutoff_callback_stress_test config_dir [audio_threads]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <freq_cutoff_plugin.h>
+
+constexpr int server_count = 4;
+constexpr int clients_per_server = 8;
+constexpr int conf_edits = 2000;
+
+// uids change every so often, as if other users took over the client ids
+std::atomic<int> uid_lookups{0};
+
+unsigned int server_list(uint64** result) {
+    uint64* servers = (uint64*)malloc((server_count + 1) * sizeof(uint64));
+    for (int i = 0; i < server_count; i++) {
+        servers[i] = i + 1;
+    }
+    servers[server_count] = 0;
+    *result = servers;
+    return ERROR_ok;
+}
+
+unsigned int client_list(uint64, anyID** result) {
+    anyID* clients =
+        (anyID*)malloc((clients_per_server + 1) * sizeof(anyID));
+    for (int i = 0; i < clients_per_server; i++) {
+        clients[i] = (anyID)(i + 1);
+    }
+    clients[clients_per_server] = 0;
+    *result = clients;
+    return ERROR_ok;
+}
+
+unsigned int client_uid(uint64, anyID client_id, size_t, char** result) {
+    int user = (uid_lookups++ / 50) % 7;
+    std::string uid =
+        "uid" + std::to_string(client_id) + "_" + std::to_string(user);
+    *result = strdup(uid.c_str());
+    return ERROR_ok;
+}
+
+unsigned int log_message(const char*, LogLevel, const char*, uint64) {
+    return ERROR_ok;
+}
+
+unsigned int free_memory(void* pointer) {
+    free(pointer);
+    return ERROR_ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s config_dir [audio_threads]\n", argv[0]);
+        return 2;
+    }
+    std::string config_dir = argv[1];
+    int audio_threads = argc > 2 ? atoi(argv[2]) : 2 * server_count;
+    std::filesystem::remove_all(config_dir);
+    std::filesystem::create_directories(config_dir);
+
+    static TS3Functions ts3_functions;
+    ts3_functions.getServerConnectionHandlerList = server_list;
+    ts3_functions.getClientList = client_list;
+    ts3_functions.getClientVariableAsString = client_uid;
+    ts3_functions.logMessage = log_message;
+    ts3_functions.freeMemory = free_memory;
+    if (freq_cutoff_init(config_dir.c_str(), ts3_functions) != 0) {
+        return 1;
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<long> frames{0};
+    std::vector<std::thread> audio;
+    for (int t = 0; t < audio_threads; t++) {
+        audio.emplace_back([&, t] {
+            uint64 server_id = 1 + t % server_count;
+            short samples[960 * 2];
+            long n = 0;
+            while (!stop) {
+                for (anyID client_id = 1; client_id <= clients_per_server;
+                     client_id++) {
+                    for (short& sample : samples) {
+                        sample = (short)(n++ * 31 % 2000);
+                    }
+                    int channels = 1 + client_id % 2;
+                    freq_cutoff_onEditPlaybackVoiceDataEvent(
+                        ts3_functions, server_id, client_id, samples, 480,
+                        channels);
+                    frames++;
+                }
+            }
+        });
+    }
+
+    std::thread events([&] {
+        for (int i = 0; !stop; i++) {
+            uint64 server_id = 1 + i % server_count;
+            if (i % 40 == 0) {
+                freq_cutoff_onConnectStatusChangeEvent(
+                    ts3_functions, server_id, STATUS_DISCONNECTED);
+                freq_cutoff_onConnectStatusChangeEvent(
+                    ts3_functions, server_id, STATUS_CONNECTION_ESTABLISHED);
+            }
+            for (anyID client_id = 1; client_id <= clients_per_server;
+                 client_id++) {
+                int visibility =
+                    i % 7 == 0 ? LEAVE_VISIBILITY : ENTER_VISIBILITY;
+                freq_cutoff_onClientMoveEvent(ts3_functions, server_id,
+                                              client_id, visibility);
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+
+    // the dialog: edits, removals and saves
+    for (int i = 0; i < conf_edits; i++) {
+        FilterConf conf(i % 3 != 0, 100 * (i % 90), 2 + 2 * (i % 4));
+        std::string uid = "uid" + std::to_string(1 + i % clients_per_server) +
+                          "_" + std::to_string(i % 7);
+        filter_group->update_conf(uid, i % 5 == 0 ? nullptr : &conf);
+        if (i % 10 == 0) {
+            filter_group->persist();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    stop = true;
+    for (std::thread& thread : audio) {
+        thread.join();
+    }
+    events.join();
+    freq_cutoff_shutdown(ts3_functions);
+    printf("%ld frames from %i threads\n", frames.load(), audio_threads);
+    return frames > 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2018 Michael Vilim
+ *
+ * This file is part of the teamspeak frequency cutoff filter plugin. It is
+ * currently hosted at https://github.com/mvilim/ts3-frequency-cutoff-plugin
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Converts the plugin's config between the text format and the binary format
+// (see binary_config.h). The plugin uses frequency_cutoff_plugin.bin in place
+// of frequency_cutoff_plugin.conf when it is present.
+//
+//   config_convert to-binary frequency_cutoff_plugin.conf out.bin
+//   config_convert to-text frequency_cutoff_plugin.bin out.conf
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <atomic_file.h>
+#include <binary_config.h>
+#include <config_parser.h>
+
+// The binary format only has a byte for the order. Orders that do not fit are
+// invalid anyway, and both formats read an invalid order as the default.
+int to_binary(const std::string& input, const std::string& output) {
+    std::string text;
+    if (!read_config_file(input, text)) {
+        fprintf(stderr, "Could not read %s\n", input.c_str());
+        return 1;
+    }
+    ConfigParseStats stats;
+    std::vector<ConfigLine> lines = load_config_lines(text, stats);
+    for (ConfigLine& line : lines) {
+        if (line.order < 0 || line.order > 255) {
+            line.order = 0;
+        }
+    }
+    write_file_atomic(output, encode_binary_config(lines));
+    printf("Wrote %zu entries to %s", lines.size(), output.c_str());
+    if (stats.malformed > 0) {
+        printf(", skipped %zu malformed lines (the first is line %zu)",
+               stats.malformed, stats.first_malformed_line);
+    }
+    printf("\n");
+    return 0;
+}
+
+int to_text(const std::string& input, const std::string& output) {
+    BinaryConfig config(input);
+    std::string text;
+    std::string_view last_name;
+    for (size_t i = 0; i < config.size(); i++) {
+        ConfigLine line = config.entry(i);
+        if (i > 0 && !(last_name < line.name)) {
+            fprintf(stderr, "%s is not sorted at entry %zu\n", input.c_str(),
+                    i);
+            return 1;
+        }
+        last_name = line.name;
+        text.append(line.name);
+        text += " " + std::to_string(line.cutoff_freq) + " " +
+                (line.enabled ? "1" : "0");
+        if (line.order != 0) {
+            text += " " + std::to_string(line.order);
+        }
+        text += "\n";
+    }
+    write_file_atomic(output, text);
+    printf("Wrote %zu entries to %s\n", config.size(), output.c_str());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4 || (std::strcmp(argv[1], "to-binary") != 0 &&
+                      std::strcmp(argv[1], "to-text") != 0)) {
+        fprintf(stderr,
+                "usage: %s to-binary <text config> <binary config>\n"
+                "       %s to-text <binary config> <text config>\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    try {
+        if (std::strcmp(argv[1], "to-binary") == 0) {
+            return to_binary(argv[2], argv[3]);
+        }
+        return to_text(argv[2], argv[3]);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}